@@ -0,0 +1,32 @@
+
+#ifndef SHP_COORD_SPAN_H
+#define SHP_COORD_SPAN_H
+
+#include <stdint.h>
+#include "wk-v1.h"
+
+// wk handlers receive one coord() call per vertex. Handlers that can
+// accept all the coordinates of a linestring or ring at once can register
+// a span callback for their coord() callback. A span callback receives
+// `n_coords` coordinates that are each `stride` doubles apart and must
+// behave like n_coords calls to coord() with coord_id, coord_id + 1, ...
+typedef int (*shp_coord_fn_t)(const wk_meta_t* meta, const double* coord, uint32_t coord_id,
+                              void* handler_data);
+typedef int (*shp_coord_span_fn_t)(const wk_meta_t* meta, const double* coords, uint32_t n_coords,
+                                   uint32_t stride, uint32_t coord_id, void* handler_data);
+
+// Registers (or, if `coord_span` is NULL, unregisters) the span callback
+// for handlers whose coord callback is `coord`. Returns 0 on success or
+// 1 if too many span callbacks are registered. From another package
+// (with LinkingTo: shp), use:
+//
+// shp_register_coord_span_t shp_register_coord_span =
+//   (shp_register_coord_span_t) R_GetCCallable("shp", "shp_register_coord_span");
+//
+// The registry keeps the function pointers as-is, so a package that
+// registers a span callback must unregister it (i.e., call
+// shp_register_coord_span(coord, NULL)) from its R_unload_<pkg>() hook.
+// Otherwise shp would call into an unloaded DLL.
+typedef int (*shp_register_coord_span_t)(shp_coord_fn_t coord, shp_coord_span_fn_t coord_span);
+
+#endif
@@ -4,6 +4,14 @@
 
 #include "cpp11/declarations.hpp"
 
+// shp-dbf-write.cpp
+void cpp_write_dbf(std::string filename, std::string filename_cpg, list x, strings field_names, int n_rows);
+extern "C" SEXP _shp_cpp_write_dbf(SEXP filename, SEXP filename_cpg, SEXP x, SEXP field_names, SEXP n_rows) {
+  BEGIN_CPP11
+    cpp_write_dbf(cpp11::as_cpp<cpp11::decay_t<std::string>>(filename), cpp11::as_cpp<cpp11::decay_t<std::string>>(filename_cpg), cpp11::as_cpp<cpp11::decay_t<list>>(x), cpp11::as_cpp<cpp11::decay_t<strings>>(field_names), cpp11::as_cpp<cpp11::decay_t<int>>(n_rows));
+    return R_NilValue;
+  END_CPP11
+}
 // shp-dbf.cpp
 list cpp_dbf_meta(std::string filename);
 extern "C" SEXP _shp_cpp_dbf_meta(SEXP filename) {
@@ -19,40 +27,92 @@ extern "C" SEXP _shp_cpp_dbf_colmeta(SEXP filename) {
   END_CPP11
 }
 // shp-dbf.cpp
-list cpp_read_dbf(std::string filename, std::string col_spec, std::string encoding);
-extern "C" SEXP _shp_cpp_read_dbf(SEXP filename, SEXP col_spec, SEXP encoding) {
+list cpp_read_dbf(std::string filename, std::string col_spec, std::string encoding, int skip, int n_max, sexp rows, int num_threads);
+extern "C" SEXP _shp_cpp_read_dbf(SEXP filename, SEXP col_spec, SEXP encoding, SEXP skip, SEXP n_max, SEXP rows, SEXP num_threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(cpp_read_dbf(cpp11::as_cpp<cpp11::decay_t<std::string>>(filename), cpp11::as_cpp<cpp11::decay_t<std::string>>(col_spec), cpp11::as_cpp<cpp11::decay_t<std::string>>(encoding), cpp11::as_cpp<cpp11::decay_t<int>>(skip), cpp11::as_cpp<cpp11::decay_t<int>>(n_max), cpp11::as_cpp<cpp11::decay_t<sexp>>(rows), cpp11::as_cpp<cpp11::decay_t<int>>(num_threads)));
+  END_CPP11
+}
+// shp-dbf.cpp
+sexp cpp_dbf_open(std::string filename, std::string encoding);
+extern "C" SEXP _shp_cpp_dbf_open(SEXP filename, SEXP encoding) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(cpp_dbf_open(cpp11::as_cpp<cpp11::decay_t<std::string>>(filename), cpp11::as_cpp<cpp11::decay_t<std::string>>(encoding)));
+  END_CPP11
+}
+// shp-dbf.cpp
+list cpp_read_dbf_chunk(sexp dbf_xptr, std::string col_spec, int skip, int n_max, int num_threads);
+extern "C" SEXP _shp_cpp_read_dbf_chunk(SEXP dbf_xptr, SEXP col_spec, SEXP skip, SEXP n_max, SEXP num_threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(cpp_read_dbf_chunk(cpp11::as_cpp<cpp11::decay_t<sexp>>(dbf_xptr), cpp11::as_cpp<cpp11::decay_t<std::string>>(col_spec), cpp11::as_cpp<cpp11::decay_t<int>>(skip), cpp11::as_cpp<cpp11::decay_t<int>>(n_max), cpp11::as_cpp<cpp11::decay_t<int>>(num_threads)));
+  END_CPP11
+}
+// shp-dbf.cpp
+void cpp_dbf_close(sexp dbf_xptr);
+extern "C" SEXP _shp_cpp_dbf_close(SEXP dbf_xptr) {
   BEGIN_CPP11
-    return cpp11::as_sexp(cpp_read_dbf(cpp11::as_cpp<cpp11::decay_t<std::string>>(filename), cpp11::as_cpp<cpp11::decay_t<std::string>>(col_spec), cpp11::as_cpp<cpp11::decay_t<std::string>>(encoding)));
+    cpp_dbf_close(cpp11::as_cpp<cpp11::decay_t<sexp>>(dbf_xptr));
+    return R_NilValue;
   END_CPP11
 }
 
 extern "C" {
 /* .Call calls */
+extern SEXP _shp_cpp_dbf_close(SEXP);
 extern SEXP _shp_cpp_dbf_colmeta(SEXP);
 extern SEXP _shp_cpp_dbf_meta(SEXP);
-extern SEXP _shp_cpp_read_dbf(SEXP, SEXP, SEXP);
+extern SEXP _shp_cpp_dbf_open(SEXP, SEXP);
+extern SEXP _shp_cpp_read_dbf(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _shp_cpp_read_dbf_chunk(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _shp_cpp_write_dbf(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP shp_c_bbox_query(SEXP, SEXP, SEXP);
+extern SEXP shp_c_build_qix(SEXP, SEXP);
+extern SEXP shp_c_build_rtx(SEXP, SEXP, SEXP);
+extern SEXP shp_c_file_cache_invalidate(SEXP);
 extern SEXP shp_c_file_meta(SEXP);
+extern SEXP shp_c_file_pin(SEXP);
+extern SEXP shp_c_file_unpin(SEXP);
+extern SEXP shp_c_geometry_buffers(SEXP);
 extern SEXP shp_c_geometry_meta(SEXP, SEXP);
-extern SEXP shp_c_handle_geometry(SEXP, SEXP);
+extern SEXP shp_c_geometry_wkb(SEXP);
+extern SEXP shp_c_handle_geometry(SEXP, SEXP, SEXP);
 extern SEXP shp_c_read_shx(SEXP, SEXP);
+extern SEXP shp_c_read_shx_cache_stats(SEXP, SEXP);
 extern SEXP shp_c_shapelib_version();
+extern SEXP shp_c_shp_writer_new(SEXP, SEXP, SEXP);
 extern SEXP shp_c_shx_meta(SEXP);
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_shp_cpp_dbf_colmeta",   (DL_FUNC) &_shp_cpp_dbf_colmeta,   1},
-    {"_shp_cpp_dbf_meta",      (DL_FUNC) &_shp_cpp_dbf_meta,      1},
-    {"_shp_cpp_read_dbf",      (DL_FUNC) &_shp_cpp_read_dbf,      3},
-    {"shp_c_file_meta",        (DL_FUNC) &shp_c_file_meta,        1},
-    {"shp_c_geometry_meta",    (DL_FUNC) &shp_c_geometry_meta,    2},
-    {"shp_c_handle_geometry",  (DL_FUNC) &shp_c_handle_geometry,  2},
-    {"shp_c_read_shx",         (DL_FUNC) &shp_c_read_shx,         2},
-    {"shp_c_shapelib_version", (DL_FUNC) &shp_c_shapelib_version, 0},
-    {"shp_c_shx_meta",         (DL_FUNC) &shp_c_shx_meta,         1},
+    {"_shp_cpp_dbf_close",          (DL_FUNC) &_shp_cpp_dbf_close,          1},
+    {"_shp_cpp_dbf_colmeta",        (DL_FUNC) &_shp_cpp_dbf_colmeta,        1},
+    {"_shp_cpp_dbf_meta",           (DL_FUNC) &_shp_cpp_dbf_meta,           1},
+    {"_shp_cpp_dbf_open",           (DL_FUNC) &_shp_cpp_dbf_open,           2},
+    {"_shp_cpp_read_dbf",           (DL_FUNC) &_shp_cpp_read_dbf,           7},
+    {"_shp_cpp_read_dbf_chunk",     (DL_FUNC) &_shp_cpp_read_dbf_chunk,     5},
+    {"_shp_cpp_write_dbf",          (DL_FUNC) &_shp_cpp_write_dbf,          5},
+    {"shp_c_bbox_query",            (DL_FUNC) &shp_c_bbox_query,            3},
+    {"shp_c_build_qix",             (DL_FUNC) &shp_c_build_qix,             2},
+    {"shp_c_build_rtx",             (DL_FUNC) &shp_c_build_rtx,             3},
+    {"shp_c_file_cache_invalidate", (DL_FUNC) &shp_c_file_cache_invalidate, 1},
+    {"shp_c_file_meta",             (DL_FUNC) &shp_c_file_meta,             1},
+    {"shp_c_file_pin",              (DL_FUNC) &shp_c_file_pin,              1},
+    {"shp_c_file_unpin",            (DL_FUNC) &shp_c_file_unpin,            1},
+    {"shp_c_geometry_buffers",      (DL_FUNC) &shp_c_geometry_buffers,      1},
+    {"shp_c_geometry_meta",         (DL_FUNC) &shp_c_geometry_meta,         2},
+    {"shp_c_geometry_wkb",          (DL_FUNC) &shp_c_geometry_wkb,          1},
+    {"shp_c_handle_geometry",       (DL_FUNC) &shp_c_handle_geometry,       3},
+    {"shp_c_read_shx",              (DL_FUNC) &shp_c_read_shx,              2},
+    {"shp_c_read_shx_cache_stats",  (DL_FUNC) &shp_c_read_shx_cache_stats,  2},
+    {"shp_c_shapelib_version",      (DL_FUNC) &shp_c_shapelib_version,      0},
+    {"shp_c_shp_writer_new",        (DL_FUNC) &shp_c_shp_writer_new,        3},
+    {"shp_c_shx_meta",              (DL_FUNC) &shp_c_shx_meta,              1},
     {NULL, NULL, 0}
 };
 }
 
+void shp_init_callables(DllInfo* dll);
 extern "C" void R_init_shp(DllInfo* dll){
   R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
+  shp_init_callables(dll);
 }
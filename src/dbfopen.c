@@ -364,6 +364,9 @@ static int DBFFlushRecord( DBFHandle psDBF )
     {
 	psDBF->bCurrentRecordModified = FALSE;
 
+        /* The read-ahead block may contain a stale copy of this record */
+        psDBF->nReadBlockRecords = 0;
+
 	nRecordOffset =
             psDBF->nRecordLength * STATIC_CAST(SAOffset, psDBF->nCurrentRecord)
             + psDBF->nHeaderLength;
@@ -393,6 +396,66 @@ static int DBFFlushRecord( DBFHandle psDBF )
     return TRUE;
 }
 
+/************************************************************************/
+/*                         DBFLoadReadBlock()                           */
+/*                                                                      */
+/*      Fill the read-ahead block with as many whole records as fit     */
+/*      in the block size starting at iRecord using a single read.      */
+/************************************************************************/
+
+static int DBFLoadReadBlock( DBFHandle psDBF, int iRecord )
+
+{
+    SAOffset nRecordOffset;
+    int nBlockRecords;
+    SAOffset nRead;
+
+    nBlockRecords = psDBF->nReadBlockSize / psDBF->nRecordLength;
+    if( nBlockRecords > psDBF->nRecords - iRecord )
+        nBlockRecords = psDBF->nRecords - iRecord;
+
+    psDBF->nReadBlockRecords = 0;
+
+    if( psDBF->pszReadBlock == SHPLIB_NULLPTR )
+    {
+        psDBF->pszReadBlock = STATIC_CAST(char *,
+            malloc(STATIC_CAST(size_t, psDBF->nReadBlockSize)));
+        if( psDBF->pszReadBlock == SHPLIB_NULLPTR )
+        {
+            psDBF->sHooks.Error( "Failed to allocate DBF read block." );
+            return FALSE;
+        }
+    }
+
+    nRecordOffset =
+        psDBF->nRecordLength * STATIC_CAST(SAOffset,iRecord) + psDBF->nHeaderLength;
+
+    if( psDBF->sHooks.FSeek( psDBF->fp, nRecordOffset, SEEK_SET ) != 0 )
+    {
+        char szMessage[128];
+        snprintf( szMessage, sizeof(szMessage), "fseek(%ld) failed on DBF file.",
+                  STATIC_CAST(long, nRecordOffset) );
+        psDBF->sHooks.Error( szMessage );
+        return FALSE;
+    }
+
+    /* A truncated file is only an error for records that were requested */
+    nRead = psDBF->sHooks.FRead( psDBF->pszReadBlock, psDBF->nRecordLength,
+                                 nBlockRecords, psDBF->fp );
+    if( nRead < 1 )
+    {
+        char szMessage[128];
+        snprintf( szMessage, sizeof(szMessage), "fread(%d) failed on DBF file.",
+                 psDBF->nRecordLength );
+        psDBF->sHooks.Error( szMessage );
+        return FALSE;
+    }
+
+    psDBF->nReadBlockFirstRecord = iRecord;
+    psDBF->nReadBlockRecords = STATIC_CAST(int, nRead);
+    return TRUE;
+}
+
 /************************************************************************/
 /*                           DBFLoadRecord()                            */
 /************************************************************************/
@@ -407,6 +470,28 @@ static int DBFLoadRecord( DBFHandle psDBF, int iRecord )
 	if( !DBFFlushRecord( psDBF ) )
             return FALSE;
 
+/* -------------------------------------------------------------------- */
+/*      In block mode, serve the record from the read-ahead block,      */
+/*      refilling it if the record isn't there.                         */
+/* -------------------------------------------------------------------- */
+        if( psDBF->nReadBlockSize >= psDBF->nRecordLength )
+        {
+            if( iRecord < psDBF->nReadBlockFirstRecord ||
+                iRecord >= psDBF->nReadBlockFirstRecord + psDBF->nReadBlockRecords )
+            {
+                if( !DBFLoadReadBlock( psDBF, iRecord ) )
+                    return FALSE;
+            }
+
+            memcpy( psDBF->pszCurrentRecord,
+                    psDBF->pszReadBlock +
+                        STATIC_CAST(size_t, iRecord - psDBF->nReadBlockFirstRecord) *
+                        psDBF->nRecordLength,
+                    psDBF->nRecordLength );
+            psDBF->nCurrentRecord = iRecord;
+            return TRUE;
+        }
+
 	nRecordOffset =
             psDBF->nRecordLength * STATIC_CAST(SAOffset,iRecord) + psDBF->nHeaderLength;
 
@@ -771,6 +856,7 @@ DBFClose(DBFHandle psDBF)
 
     free( psDBF->pszHeader );
     free( psDBF->pszCurrentRecord );
+    free( psDBF->pszReadBlock );
     free( psDBF->pszCodePage );
 
     free( psDBF );
@@ -1129,6 +1215,7 @@ DBFAddNativeFieldType(DBFHandle psDBF, const char * pszFieldName,
 
     psDBF->nCurrentRecord = -1;
     psDBF->bCurrentRecordModified = FALSE;
+    psDBF->nReadBlockRecords = 0;
     psDBF->bUpdated = TRUE;
 
     return( psDBF->nFields-1 );
@@ -1777,6 +1864,42 @@ DBFReadTuple(DBFHandle psDBF, int hEntity )
     return STATIC_CAST(const char *, psDBF->pszCurrentRecord);
 }
 
+/************************************************************************/
+/*                          DBFReadTupleView()                          */
+/*                                                                      */
+/*      Like DBFReadTuple(), but when block reads are enabled the       */
+/*      result points into the read-ahead block rather than being       */
+/*      copied to the current record. The result must not be           */
+/*      modified and is only valid till the next record read.           */
+/************************************************************************/
+
+const char SHPAPI_CALL1(*)
+DBFReadTupleView(DBFHandle psDBF, int hEntity )
+
+{
+    if( psDBF->nReadBlockSize < psDBF->nRecordLength ||
+        hEntity == psDBF->nCurrentRecord )
+        return DBFReadTuple( psDBF, hEntity );
+
+    if( hEntity < 0 || hEntity >= psDBF->nRecords )
+        return SHPLIB_NULLPTR;
+
+    /* Pending changes must be written before the block can be trusted */
+    if( !DBFFlushRecord( psDBF ) )
+        return SHPLIB_NULLPTR;
+
+    if( hEntity < psDBF->nReadBlockFirstRecord ||
+        hEntity >= psDBF->nReadBlockFirstRecord + psDBF->nReadBlockRecords )
+    {
+        if( !DBFLoadReadBlock( psDBF, hEntity ) )
+            return SHPLIB_NULLPTR;
+    }
+
+    return STATIC_CAST(const char *, psDBF->pszReadBlock +
+        STATIC_CAST(size_t, hEntity - psDBF->nReadBlockFirstRecord) *
+        psDBF->nRecordLength);
+}
+
 /************************************************************************/
 /*                          DBFCloneEmpty()                              */
 /*                                                                      */
@@ -2067,6 +2190,7 @@ DBFDeleteField(DBFHandle psDBF, int iField)
 
     psDBF->nCurrentRecord = -1;
     psDBF->bCurrentRecordModified = FALSE;
+    psDBF->nReadBlockRecords = 0;
     psDBF->bUpdated = TRUE;
 
     return TRUE;
@@ -2180,6 +2304,7 @@ DBFReorderFields( DBFHandle psDBF, int* panMap )
 
     psDBF->nCurrentRecord = -1;
     psDBF->bCurrentRecordModified = FALSE;
+    psDBF->nReadBlockRecords = 0;
     psDBF->bUpdated = TRUE;
 
     return TRUE;
@@ -2422,6 +2547,7 @@ DBFAlterFieldDefn( DBFHandle psDBF, int iField, const char * pszFieldName,
 
     psDBF->nCurrentRecord = -1;
     psDBF->bCurrentRecordModified = FALSE;
+    psDBF->nReadBlockRecords = 0;
     psDBF->bUpdated = TRUE;
 
     return TRUE;
@@ -2435,3 +2561,27 @@ void SHPAPI_CALL DBFSetWriteEndOfFileChar( DBFHandle psDBF, int bWriteFlag )
 {
     psDBF->bWriteEndOfFileChar = bWriteFlag;
 }
+
+/************************************************************************/
+/*                        DBFSetReadBlockSize()                         */
+/*                                                                      */
+/*      Enable (nBlockSize > 0) or disable (nBlockSize == 0) reading    */
+/*      records in blocks of up to nBlockSize bytes. This makes a       */
+/*      sequential scan one read per block rather than one seek and     */
+/*      read per record.                                                */
+/************************************************************************/
+
+void SHPAPI_CALL DBFSetReadBlockSize( DBFHandle psDBF, int nBlockSize )
+{
+    if( nBlockSize < 0 )
+        nBlockSize = 0;
+
+    if( nBlockSize == psDBF->nReadBlockSize )
+        return;
+
+    free( psDBF->pszReadBlock );
+    psDBF->pszReadBlock = SHPLIB_NULLPTR;
+    psDBF->nReadBlockSize = nBlockSize;
+    psDBF->nReadBlockFirstRecord = 0;
+    psDBF->nReadBlockRecords = 0;
+}
@@ -4,22 +4,33 @@
 
 #ifdef __cplusplus
 #include <cstdio>
+#include <cstdint>
 #else
 #include <stdio.h>
+#include <stdint.h>
 #endif
 
+// Offsets are 64-bit everywhere (`long` is 32-bit on Windows) so that
+// files larger than 2 GB can be read on all platforms.
 typedef struct {
     void* (*fopen)(const char* filename, const char* mode);
     void (*fclose)(void* handle);
     size_t (*fread)(void* dest, size_t size, size_t n, void* handle);
-    int (*fseek)(void* handle, long offset, int whence);
-    long (*ftell)(void* handle);
+    int (*fseek)(void* handle, int64_t offset, int whence);
+    int64_t (*ftell)(void* handle);
+    // Optional (may be NULL): returns a pointer to `size` bytes starting at
+    // `offset` that remains valid until fclose() is called, or NULL if
+    // the implementation can't provide one. Callers must fall back
+    // to fseek() + fread() if this returns NULL.
+    const unsigned char* (*fdata)(void* handle, int64_t offset, size_t size);
 } minishp_file_t;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 minishp_file_t minishp_file_default();
+minishp_file_t minishp_file_mmap();
+void* minishp_file_open_best(minishp_file_t* file, const char* filename);
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +38,17 @@ minishp_file_t minishp_file_default();
 #ifdef MINISHP_IMPL
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define minishp_fseek64 _fseeki64
+#define minishp_ftell64 _ftelli64
+#else
+#include <sys/types.h>
+#define minishp_fseek64 fseeko
+#define minishp_ftell64 ftello
+#endif
 
 typedef struct {
     FILE* file;
@@ -61,14 +83,14 @@ size_t minishp_file_default_fread(void* dest, size_t size, size_t n, void* handl
     return fread(dest, size, n, file->file);
 }
 
-int minishp_file_default_fseek(void* handle, long offset, int whence) {
+int minishp_file_default_fseek(void* handle, int64_t offset, int whence) {
     minishp_file_default_t* file = (minishp_file_default_t*) handle;
-    return fseek(file->file, offset, whence);
+    return minishp_fseek64(file->file, offset, whence);
 }
 
-long minishp_file_default_ftell(void* handle) {
+int64_t minishp_file_default_ftell(void* handle) {
     minishp_file_default_t* file = (minishp_file_default_t*) handle;
-    return ftell(file->file);
+    return minishp_ftell64(file->file);
 }
 
 minishp_file_t minishp_file_default() {
@@ -77,12 +99,231 @@ minishp_file_t minishp_file_default() {
         &minishp_file_default_fclose,
         &minishp_file_default_fread,
         &minishp_file_default_fseek,
-        &minishp_file_default_ftell
+        &minishp_file_default_ftell,
+        NULL
+    };
+
+    return file;
+}
+
+// A read-only memory-mapped implementation. This lets readers use
+// pointers into the file contents rather than copying them and avoids
+// a system call per read when the file is in the page cache.
+// Files that can't be mapped (e.g., too big for the address
+// space on 32-bit platforms) fail to open so that callers
+// can use minishp_file_open_best() to fall back to stdio.
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} minishp_file_mmap_t;
+
+void* minishp_file_mmap_fopen(const char* filename, const char* mode) {
+    // only read-only mappings are supported
+    if ((strchr(mode, 'w') != NULL) || (strchr(mode, 'a') != NULL) || (strchr(mode, '+') != NULL)) {
+        return NULL;
+    }
+
+    minishp_file_mmap_t* file = (minishp_file_mmap_t*) malloc(sizeof(minishp_file_mmap_t));
+    if (file == NULL) {
+        return NULL;
+    }
+
+    file->data = NULL;
+    file->size = 0;
+    file->offset = 0;
+
+#ifdef _WIN32
+    file->mapping = NULL;
+
+    HANDLE handle = CreateFileA(
+        filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        free(file);
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || ((uint64_t) size.QuadPart > (uint64_t) SIZE_MAX)) {
+        CloseHandle(handle);
+        free(file);
+        return NULL;
+    }
+    file->size = (size_t) size.QuadPart;
+
+    // zero-length files can't be mapped but are valid
+    if (file->size > 0) {
+        file->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (file->mapping != NULL) {
+            file->data = (const unsigned char*) MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+
+        if (file->data == NULL) {
+            if (file->mapping != NULL) {
+                CloseHandle(file->mapping);
+            }
+            CloseHandle(handle);
+            free(file);
+            return NULL;
+        }
+    }
+
+    // the mapping keeps its own reference to the file
+    CloseHandle(handle);
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        free(file);
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if ((fstat(fd, &file_stat) != 0) || ((uint64_t) file_stat.st_size > (uint64_t) SIZE_MAX)) {
+        close(fd);
+        free(file);
+        return NULL;
+    }
+    file->size = (size_t) file_stat.st_size;
+
+    // zero-length files can't be mapped but are valid
+    if (file->size > 0) {
+        void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            free(file);
+            return NULL;
+        }
+
+        file->data = (const unsigned char*) data;
+    }
+
+    // the mapping keeps its own reference to the file
+    close(fd);
+#endif
+
+    return file;
+}
+
+void minishp_file_mmap_fclose(void* handle) {
+    minishp_file_mmap_t* file = (minishp_file_mmap_t*) handle;
+    if (file == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    if (file->data != NULL) {
+        UnmapViewOfFile(file->data);
+    }
+    if (file->mapping != NULL) {
+        CloseHandle(file->mapping);
+    }
+#else
+    if (file->data != NULL) {
+        munmap((void*) file->data, file->size);
+    }
+#endif
+
+    free(file);
+}
+
+size_t minishp_file_mmap_fread(void* dest, size_t size, size_t n, void* handle) {
+    minishp_file_mmap_t* file = (minishp_file_mmap_t*) handle;
+    if ((size == 0) || (file->offset >= file->size)) {
+        return 0;
+    }
+
+    size_t n_available = (file->size - file->offset) / size;
+    if (n > n_available) {
+        n = n_available;
+    }
+
+    memcpy(dest, file->data + file->offset, size * n);
+    file->offset += size * n;
+    return n;
+}
+
+int minishp_file_mmap_fseek(void* handle, int64_t offset, int whence) {
+    minishp_file_mmap_t* file = (minishp_file_mmap_t*) handle;
+    int64_t new_offset;
+    switch (whence) {
+    case SEEK_SET:
+        new_offset = offset;
+        break;
+    case SEEK_CUR:
+        new_offset = (int64_t) file->offset + offset;
+        break;
+    case SEEK_END:
+        new_offset = (int64_t) file->size + offset;
+        break;
+    default:
+        return -1;
+    }
+
+    if ((new_offset < 0) || (((uint64_t) new_offset) > (uint64_t) file->size)) {
+        return -1;
+    }
+
+    file->offset = (size_t) new_offset;
+    return 0;
+}
+
+int64_t minishp_file_mmap_ftell(void* handle) {
+    minishp_file_mmap_t* file = (minishp_file_mmap_t*) handle;
+    return (int64_t) file->offset;
+}
+
+const unsigned char* minishp_file_mmap_fdata(void* handle, int64_t offset, size_t size) {
+    minishp_file_mmap_t* file = (minishp_file_mmap_t*) handle;
+    if ((offset < 0) || (((uint64_t) offset) > (uint64_t) file->size) || (size > (file->size - (size_t) offset))) {
+        return NULL;
+    }
+
+    return file->data + offset;
+}
+
+minishp_file_t minishp_file_mmap() {
+    minishp_file_t file = {
+        &minishp_file_mmap_fopen,
+        &minishp_file_mmap_fclose,
+        &minishp_file_mmap_fread,
+        &minishp_file_mmap_fseek,
+        &minishp_file_mmap_ftell,
+        &minishp_file_mmap_fdata
     };
 
     return file;
 }
 
+// Open `filename` for reading using a memory map if possible, falling back
+// to buffered stdio. `file` is set to the implementation that was used.
+void* minishp_file_open_best(minishp_file_t* file, const char* filename) {
+#ifndef MINISHP_NO_MMAP
+    *file = minishp_file_mmap();
+    void* handle = file->fopen(filename, "rb");
+    if (handle != NULL) {
+        return handle;
+    }
+#endif
+
+    *file = minishp_file_default();
+    return file->fopen(filename, "rb");
+}
+
 #endif
 
 #endif
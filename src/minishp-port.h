@@ -119,4 +119,59 @@ static inline uint64_t bswap_64(uint64_t x) {
 
 #endif
 
+// byte swap an array of uint32_t in place (e.g., the big-endian offsets and
+// content lengths of a .shx). Uses the widest vector instructions the
+// compiler was allowed to emit, falling back to bswap_32().
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline void minishp_bswap_32_n(uint32_t* values, size_t n) {
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i mask = _mm256_setr_epi8(
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+  );
+  for (; (i + 8) <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (values + i));
+    _mm256_storeu_si256((__m256i*) (values + i), _mm256_shuffle_epi8(v, mask));
+  }
+#elif defined(__SSSE3__)
+  const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (; (i + 4) <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (values + i));
+    _mm_storeu_si128((__m128i*) (values + i), _mm_shuffle_epi8(v, mask));
+  }
+#elif defined(__SSE2__)
+  // no byte shuffle before SSSE3: swap the bytes of each 16-bit word,
+  // then swap the 16-bit words of each 32-bit value
+  for (; (i + 4) <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (values + i));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128((__m128i*) (values + i), v);
+  }
+#endif
+
+  for (; i < n; i++) {
+    values[i] = bswap_32(values[i]);
+  }
+}
+
 #endif
@@ -0,0 +1,559 @@
+#ifndef MINISHP_RTX_H
+#define MINISHP_RTX_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+#include "minishp-file.h"
+
+// A static, packed (Hilbert-sorted) R-tree over the bounds of the
+// non-null shapes in a .shp file, modeled after flatbush
+// (https://github.com/mourner/flatbush). The file is designed to be
+// memory-mapped and queried in place:
+//
+// - a 64-byte header (all values little endian):
+//     char[4] magic ("SRTX"), uint32 version, uint32 node_size,
+//     uint32 n_items, uint32 n_nodes, uint32 n_levels,
+//     uint32 n_features, uint32 reserved, uint64 shp_size,
+//     24 reserved bytes
+// - uint32 level_end[n_levels]: one past the last node of each level
+//   (leaves first, root last)
+// - double boxes[n_nodes][4]: xmin, ymin, xmax, ymax of each node
+// - uint32 indices[n_nodes]: the shape id for leaves or the position of
+//   the first child for all other nodes
+//
+// Each section starts on a 64-byte boundary such that two boxes occupy
+// exactly one cache line. n_features and shp_size record the .shp the
+// index was built from so that a stale index can be detected.
+
+#define RTX_ERROR_SIZE 1024
+#define RTX_HEADER_SIZE 64
+#define RTX_ALIGN 64
+#define RTX_VERSION 1
+#define RTX_DEFAULT_NODE_SIZE 16
+
+typedef struct {
+    uint32_t version;
+    uint32_t node_size;
+    uint32_t n_items;
+    uint32_t n_nodes;
+    uint32_t n_levels;
+    uint32_t n_features;
+    uint64_t shp_size;
+} rtx_header_t;
+
+typedef struct {
+    void* file_handle;
+    minishp_file_t file;
+    char error_buf[RTX_ERROR_SIZE];
+    rtx_header_t header;
+    const unsigned char* level_end;
+    const unsigned char* boxes;
+    const unsigned char* indices;
+    // used when the file can't be memory-mapped
+    unsigned char* data_buf;
+} rtx_file_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rtx_write(const char* filename, const double* xmin, const double* ymin,
+              const double* xmax, const double* ymax, const uint32_t* ids,
+              uint32_t n, uint32_t node_size, uint32_t n_features, uint64_t shp_size,
+              char* error_buf);
+rtx_file_t* rtx_open(const char* filename);
+int rtx_valid(rtx_file_t* rtx);
+uint32_t* rtx_search(rtx_file_t* rtx, double xmin, double ymin, double xmax, double ymax,
+                     uint32_t* n_found);
+void rtx_close(rtx_file_t* rtx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef MINISHP_IMPL
+
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include "minishp-port.h"
+
+static inline size_t rtx_align(size_t size) {
+    return (size + RTX_ALIGN - 1) / RTX_ALIGN * RTX_ALIGN;
+}
+
+static inline double rtx_le_double(const unsigned char* ptr) {
+    double value;
+#ifdef IS_BIG_ENDIAN
+    unsigned char swapped[8];
+    for (int i = 0; i < 8; i++) {
+        swapped[i] = ptr[7 - i];
+    }
+    memcpy(&value, swapped, sizeof(double));
+#else
+    memcpy(&value, ptr, sizeof(double));
+#endif
+    return value;
+}
+
+static inline uint32_t rtx_le_uint32(const unsigned char* ptr) {
+    return ((uint32_t) ptr[0]) |
+        (((uint32_t) ptr[1]) << 8) |
+        (((uint32_t) ptr[2]) << 16) |
+        (((uint32_t) ptr[3]) << 24);
+}
+
+static inline void rtx_put_le_uint32(unsigned char* ptr, uint32_t value) {
+    ptr[0] = value & 0xff;
+    ptr[1] = (value >> 8) & 0xff;
+    ptr[2] = (value >> 16) & 0xff;
+    ptr[3] = (value >> 24) & 0xff;
+}
+
+static inline void rtx_put_le_double(unsigned char* ptr, double value) {
+    memcpy(ptr, &value, sizeof(double));
+#ifdef IS_BIG_ENDIAN
+    unsigned char tmp;
+    for (int i = 0; i < 4; i++) {
+        tmp = ptr[i];
+        ptr[i] = ptr[7 - i];
+        ptr[7 - i] = tmp;
+    }
+#endif
+}
+
+// Position along a Hilbert curve of order 16
+// (from https://github.com/rawrunprotected/hilbert_curves, public domain)
+static uint32_t rtx_hilbert(uint32_t x, uint32_t y) {
+    uint32_t a = x ^ y;
+    uint32_t b = 0xFFFF ^ a;
+    uint32_t c = 0xFFFF ^ (x | y);
+    uint32_t d = x & (y ^ 0xFFFF);
+
+    uint32_t A = a | (b >> 1);
+    uint32_t B = (a >> 1) ^ a;
+    uint32_t C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+    uint32_t D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+    a = A; b = B; c = C; d = D;
+    A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+    B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+    C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+    D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+    a = A; b = B; c = C; d = D;
+    A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+    B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+    C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+    D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+    a = A; b = B; c = C; d = D;
+    C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+    D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+    a = C ^ (C >> 1);
+    b = D ^ (D >> 1);
+
+    uint32_t i0 = x ^ y;
+    uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+
+    i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+    i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+    i0 = (i0 | (i0 << 2)) & 0x33333333;
+    i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+    i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+    i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+    i1 = (i1 | (i1 << 2)) & 0x33333333;
+    i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+    return (i1 << 1) | i0;
+}
+
+typedef struct {
+    uint32_t hilbert;
+    uint32_t item;
+} rtx_sort_item_t;
+
+static int rtx_compare_sort_item(const void* a, const void* b) {
+    const rtx_sort_item_t* item_a = (const rtx_sort_item_t*) a;
+    const rtx_sort_item_t* item_b = (const rtx_sort_item_t*) b;
+    if (item_a->hilbert != item_b->hilbert) {
+        return item_a->hilbert < item_b->hilbert ? -1 : 1;
+    }
+
+    return item_a->item < item_b->item ? -1 : (item_a->item > item_b->item);
+}
+
+static inline uint32_t rtx_scale(double value, double min, double width) {
+    if (width <= 0) {
+        return 0;
+    }
+
+    double scaled = (value - min) / width * 65535.0;
+    if (!(scaled >= 0)) {
+        return 0;
+    } else if (scaled > 65535) {
+        return 65535;
+    } else {
+        return (uint32_t) scaled;
+    }
+}
+
+int rtx_write(const char* filename, const double* xmin, const double* ymin,
+              const double* xmax, const double* ymax, const uint32_t* ids,
+              uint32_t n, uint32_t node_size, uint32_t n_features, uint64_t shp_size,
+              char* error_buf) {
+    if (node_size < 2) {
+        node_size = 2;
+    }
+
+    // compute the number of nodes in each level
+    uint32_t n_levels = 0;
+    uint64_t n_nodes = n;
+    uint32_t level_end[64];
+    if (n > 0) {
+        uint64_t n_level = n;
+        level_end[n_levels++] = n;
+        do {
+            n_level = (n_level + node_size - 1) / node_size;
+            n_nodes += n_level;
+            level_end[n_levels++] = (uint32_t) n_nodes;
+        } while (n_level != 1);
+    }
+
+    if (n_nodes > UINT32_MAX) {
+        snprintf(error_buf, RTX_ERROR_SIZE, "Too many features to index (%u)", n);
+        return 1;
+    }
+
+    size_t level_end_offset = RTX_HEADER_SIZE;
+    size_t boxes_offset = level_end_offset + rtx_align(n_levels * sizeof(uint32_t));
+    size_t indices_offset = boxes_offset + rtx_align(n_nodes * 4 * sizeof(double));
+    size_t file_size = indices_offset + rtx_align(n_nodes * sizeof(uint32_t));
+
+    unsigned char* buf = (unsigned char*) calloc(file_size, 1);
+    rtx_sort_item_t* sort_items = (rtx_sort_item_t*) malloc((n + 1) * sizeof(rtx_sort_item_t));
+    double* boxes = (double*) malloc((n_nodes + 1) * 4 * sizeof(double));
+    uint32_t* indices = (uint32_t*) malloc((n_nodes + 1) * sizeof(uint32_t));
+    if (buf == NULL || sort_items == NULL || boxes == NULL || indices == NULL) {
+        free(buf);
+        free(sort_items);
+        free(boxes);
+        free(indices);
+        snprintf(error_buf, RTX_ERROR_SIZE, "Failed to allocate index of size %lu", (unsigned long) file_size);
+        return 1;
+    }
+
+    // sort items along a Hilbert curve through their centers
+    double total_xmin = 0, total_ymin = 0, total_xmax = 0, total_ymax = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == 0 || xmin[i] < total_xmin) total_xmin = xmin[i];
+        if (i == 0 || ymin[i] < total_ymin) total_ymin = ymin[i];
+        if (i == 0 || xmax[i] > total_xmax) total_xmax = xmax[i];
+        if (i == 0 || ymax[i] > total_ymax) total_ymax = ymax[i];
+    }
+
+    double width = total_xmax - total_xmin;
+    double height = total_ymax - total_ymin;
+    for (uint32_t i = 0; i < n; i++) {
+        sort_items[i].hilbert = rtx_hilbert(
+            rtx_scale((xmin[i] + xmax[i]) / 2, total_xmin, width),
+            rtx_scale((ymin[i] + ymax[i]) / 2, total_ymin, height)
+        );
+        sort_items[i].item = i;
+    }
+
+    qsort(sort_items, n, sizeof(rtx_sort_item_t), &rtx_compare_sort_item);
+
+    // leaves
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t item = sort_items[i].item;
+        boxes[i * 4 + 0] = xmin[item];
+        boxes[i * 4 + 1] = ymin[item];
+        boxes[i * 4 + 2] = xmax[item];
+        boxes[i * 4 + 3] = ymax[item];
+        indices[i] = ids[item];
+    }
+
+    // each parent node covers node_size consecutive nodes from the
+    // level below
+    uint32_t pos = 0;
+    uint32_t parent = n;
+    for (uint32_t level = 0; (level + 1) < n_levels; level++) {
+        uint32_t end = level_end[level];
+        while (pos < end) {
+            uint32_t first_child = pos;
+            double node_xmin = boxes[pos * 4 + 0];
+            double node_ymin = boxes[pos * 4 + 1];
+            double node_xmax = boxes[pos * 4 + 2];
+            double node_ymax = boxes[pos * 4 + 3];
+            for (uint32_t j = 0; j < node_size && pos < end; j++, pos++) {
+                if (boxes[pos * 4 + 0] < node_xmin) node_xmin = boxes[pos * 4 + 0];
+                if (boxes[pos * 4 + 1] < node_ymin) node_ymin = boxes[pos * 4 + 1];
+                if (boxes[pos * 4 + 2] > node_xmax) node_xmax = boxes[pos * 4 + 2];
+                if (boxes[pos * 4 + 3] > node_ymax) node_ymax = boxes[pos * 4 + 3];
+            }
+
+            boxes[parent * 4 + 0] = node_xmin;
+            boxes[parent * 4 + 1] = node_ymin;
+            boxes[parent * 4 + 2] = node_xmax;
+            boxes[parent * 4 + 3] = node_ymax;
+            indices[parent] = first_child;
+            parent++;
+        }
+    }
+
+    // serialize
+    memcpy(buf, "SRTX", 4);
+    rtx_put_le_uint32(buf + 4, RTX_VERSION);
+    rtx_put_le_uint32(buf + 8, node_size);
+    rtx_put_le_uint32(buf + 12, n);
+    rtx_put_le_uint32(buf + 16, (uint32_t) n_nodes);
+    rtx_put_le_uint32(buf + 20, n_levels);
+    rtx_put_le_uint32(buf + 24, n_features);
+    rtx_put_le_uint32(buf + 32, (uint32_t) (shp_size & 0xffffffff));
+    rtx_put_le_uint32(buf + 36, (uint32_t) (shp_size >> 32));
+
+    for (uint32_t i = 0; i < n_levels; i++) {
+        rtx_put_le_uint32(buf + level_end_offset + i * 4, level_end[i]);
+    }
+
+    for (uint64_t i = 0; i < n_nodes * 4; i++) {
+        rtx_put_le_double(buf + boxes_offset + i * 8, boxes[i]);
+    }
+
+    for (uint64_t i = 0; i < n_nodes; i++) {
+        rtx_put_le_uint32(buf + indices_offset + i * 4, indices[i]);
+    }
+
+    free(sort_items);
+    free(boxes);
+    free(indices);
+
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        free(buf);
+        snprintf(error_buf, RTX_ERROR_SIZE, "Failed to open '%s' for writing", filename);
+        return 1;
+    }
+
+    size_t n_written = fwrite(buf, 1, file_size, f);
+    int close_result = fclose(f);
+    free(buf);
+    if (n_written != file_size || close_result != 0) {
+        snprintf(error_buf, RTX_ERROR_SIZE, "Failed to write '%s'", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+rtx_file_t* rtx_open(const char* filename) {
+    rtx_file_t* rtx = (rtx_file_t*) malloc(sizeof(rtx_file_t));
+    if (rtx == NULL) {
+        return NULL;
+    }
+
+    memset(rtx, 0, sizeof(rtx_file_t));
+
+    rtx->file_handle = minishp_file_open_best(&rtx->file, filename);
+    if (rtx->file_handle == NULL) {
+        snprintf(rtx->error_buf, RTX_ERROR_SIZE, "Failed to open rtx file '%s'", filename);
+        return rtx;
+    }
+
+    rtx->file.fseek(rtx->file_handle, 0, SEEK_END);
+    int64_t file_size = rtx->file.ftell(rtx->file_handle);
+    rtx->file.fseek(rtx->file_handle, 0, SEEK_SET);
+
+    unsigned char header[RTX_HEADER_SIZE];
+    if (rtx->file.fread(header, RTX_HEADER_SIZE, 1, rtx->file_handle) != 1 ||
+        memcmp(header, "SRTX", 4) != 0) {
+        snprintf(rtx->error_buf, RTX_ERROR_SIZE, "'%s' is not an rtx file", filename);
+        rtx->file.fclose(rtx->file_handle);
+        rtx->file_handle = NULL;
+        return rtx;
+    }
+
+    rtx->header.version = rtx_le_uint32(header + 4);
+    rtx->header.node_size = rtx_le_uint32(header + 8);
+    rtx->header.n_items = rtx_le_uint32(header + 12);
+    rtx->header.n_nodes = rtx_le_uint32(header + 16);
+    rtx->header.n_levels = rtx_le_uint32(header + 20);
+    rtx->header.n_features = rtx_le_uint32(header + 24);
+    rtx->header.shp_size = ((uint64_t) rtx_le_uint32(header + 32)) |
+        (((uint64_t) rtx_le_uint32(header + 36)) << 32);
+
+    size_t level_end_offset = RTX_HEADER_SIZE;
+    size_t boxes_offset = level_end_offset + rtx_align(rtx->header.n_levels * sizeof(uint32_t));
+    size_t indices_offset = boxes_offset + rtx_align(rtx->header.n_nodes * 4 * sizeof(double));
+    size_t data_size = indices_offset + rtx_align(rtx->header.n_nodes * sizeof(uint32_t));
+
+    if (rtx->header.version != RTX_VERSION ||
+        rtx->header.node_size < 2 ||
+        rtx->header.n_levels > 64 ||
+        rtx->header.n_items > rtx->header.n_nodes ||
+        (rtx->header.n_items > 0 && rtx->header.n_levels == 0) ||
+        file_size < 0 || ((uint64_t) file_size) != (uint64_t) data_size) {
+        snprintf(rtx->error_buf, RTX_ERROR_SIZE, "Invalid or unsupported rtx file '%s'", filename);
+        rtx->file.fclose(rtx->file_handle);
+        rtx->file_handle = NULL;
+        return rtx;
+    }
+
+    // use the mapped file if possible, otherwise read it all into memory
+    const unsigned char* data = NULL;
+    if (rtx->file.fdata != NULL) {
+        data = rtx->file.fdata(rtx->file_handle, 0, data_size);
+    }
+
+    if (data == NULL) {
+        rtx->data_buf = (unsigned char*) malloc(data_size);
+        if (rtx->data_buf == NULL ||
+            rtx->file.fseek(rtx->file_handle, 0, SEEK_SET) != 0 ||
+            rtx->file.fread(rtx->data_buf, 1, data_size, rtx->file_handle) != data_size) {
+            snprintf(rtx->error_buf, RTX_ERROR_SIZE, "Failed to read rtx file '%s'", filename);
+            rtx->file.fclose(rtx->file_handle);
+            rtx->file_handle = NULL;
+            return rtx;
+        }
+
+        data = rtx->data_buf;
+    }
+
+    rtx->level_end = data + level_end_offset;
+    rtx->boxes = data + boxes_offset;
+    rtx->indices = data + indices_offset;
+
+    // the last level must be the root
+    if (rtx->header.n_levels > 0 &&
+        (rtx_le_uint32(rtx->level_end) != rtx->header.n_items ||
+         rtx_le_uint32(rtx->level_end + (rtx->header.n_levels - 1) * 4) != rtx->header.n_nodes)) {
+        snprintf(rtx->error_buf, RTX_ERROR_SIZE, "Invalid or unsupported rtx file '%s'", filename);
+        rtx->file.fclose(rtx->file_handle);
+        rtx->file_handle = NULL;
+    }
+
+    return rtx;
+}
+
+int rtx_valid(rtx_file_t* rtx) {
+    return (rtx != NULL) && (rtx->file_handle != NULL);
+}
+
+static inline int rtx_node_intersects(const unsigned char* box, double xmin, double ymin,
+                                      double xmax, double ymax) {
+    return (rtx_le_double(box) <= xmax) &&
+        (rtx_le_double(box + 8) <= ymax) &&
+        (rtx_le_double(box + 16) >= xmin) &&
+        (rtx_le_double(box + 24) >= ymin);
+}
+
+// Returns the shape ids (in index order) whose bounds intersect the query
+// or NULL if the result could not be allocated. The caller must free() the
+// result.
+uint32_t* rtx_search(rtx_file_t* rtx, double xmin, double ymin, double xmax, double ymax,
+                     uint32_t* n_found) {
+    *n_found = 0;
+    uint32_t result_size = 64;
+    uint32_t* result = (uint32_t*) malloc(result_size * sizeof(uint32_t));
+
+    uint32_t n_items = rtx->header.n_items;
+    uint32_t n_nodes = rtx->header.n_nodes;
+    uint32_t n_levels = rtx->header.n_levels;
+    uint32_t node_size = rtx->header.node_size;
+
+    // each level contributes at most node_size pending nodes
+    uint32_t* stack = (uint32_t*) malloc((n_levels + 1) * node_size * sizeof(uint32_t));
+    if (result == NULL || stack == NULL) {
+        free(result);
+        free(stack);
+        snprintf(rtx->error_buf, RTX_ERROR_SIZE, "Failed to allocate search buffers");
+        return NULL;
+    }
+
+    if (n_nodes == 0) {
+        free(stack);
+        return result;
+    }
+
+    // start with the root as if it were the only child of a node
+    uint32_t n_stack = 0;
+    uint32_t first = n_nodes - 1;
+    int has_next = 1;
+    while (has_next) {
+        // find the end of the level containing this node
+        uint32_t level_end = n_nodes;
+        for (uint32_t level = 0; level < n_levels; level++) {
+            uint32_t end = rtx_le_uint32(rtx->level_end + level * 4);
+            if (end > first) {
+                level_end = end;
+                break;
+            }
+        }
+
+        uint32_t end = first + node_size;
+        if (end > level_end) {
+            end = level_end;
+        }
+
+        for (uint32_t pos = first; pos < end; pos++) {
+            if (!rtx_node_intersects(rtx->boxes + ((size_t) pos) * 32, xmin, ymin, xmax, ymax)) {
+                continue;
+            }
+
+            uint32_t index = rtx_le_uint32(rtx->indices + ((size_t) pos) * 4);
+            if (pos >= n_items) {
+                // children are always in a lower level than their parent
+                if (index < pos && n_stack < ((n_levels + 1) * node_size)) {
+                    stack[n_stack++] = index;
+                }
+            } else {
+                if (*n_found == result_size) {
+                    uint32_t* new_result = (uint32_t*) realloc(result, result_size * 2 * sizeof(uint32_t));
+                    if (new_result == NULL) {
+                        free(result);
+                        free(stack);
+                        snprintf(rtx->error_buf, RTX_ERROR_SIZE, "Failed to allocate search result");
+                        return NULL;
+                    }
+
+                    result = new_result;
+                    result_size *= 2;
+                }
+
+                result[(*n_found)++] = index;
+            }
+        }
+
+        has_next = n_stack > 0;
+        if (has_next) {
+            first = stack[--n_stack];
+        }
+    }
+
+    free(stack);
+    return result;
+}
+
+void rtx_close(rtx_file_t* rtx) {
+    if (rtx == NULL) {
+        return;
+    }
+
+    if (rtx->file_handle != NULL) {
+        rtx->file.fclose(rtx->file_handle);
+    }
+
+    free(rtx->data_buf);
+    free(rtx);
+}
+
+#endif
+
+#endif
@@ -4,12 +4,15 @@
 
 #ifdef __cplusplus
 #include <cstdint>
+#include <cstring>
 #else
 #include <stdint.h>
+#include <string.h>
 #endif
 
 #include "minishp-shx.h"
 #include "minishp-file.h"
+#include "minishp-port.h"
 
 enum shp_shape_type {
     SHP_TYPE_NULL = 0,
@@ -94,6 +97,37 @@ typedef struct {
     unsigned char coords[8 * 4];
 } shp_shape_pointz_record_t;
 
+// https://www.esri.com/Library/Whitepapers/Pdfs/Shapefile.pdf, page 15 (MultiPatch)
+enum shp_part_type {
+    SHP_PART_TRIANGLE_STRIP = 0,
+    SHP_PART_TRIANGLE_FAN = 1,
+    SHP_PART_OUTER_RING = 2,
+    SHP_PART_INNER_RING = 3,
+    SHP_PART_FIRST_RING = 4,
+    SHP_PART_RING = 5
+};
+
+// A view of a single shape record. Pointers point into the record buffer
+// or the memory-mapped file (valid until the next record is read) and are stored as little-endian
+// bytes exactly as they are in the file (use shp_le_double() and
+// shp_le_uint32() to read them). Optional arrays are NULL when the
+// record doesn't contain them.
+typedef struct {
+    uint32_t record_number;
+    uint32_t content_length;
+    uint32_t shape_type;
+    uint32_t n_parts;
+    uint32_t n_points;
+    const unsigned char* bounds;
+    const unsigned char* parts;
+    const unsigned char* part_types;
+    const unsigned char* xy;
+    const unsigned char* z_range;
+    const unsigned char* z;
+    const unsigned char* m_range;
+    const unsigned char* m;
+} shp_shape_t;
+
 #define SHP_ERROR_SIZE 1024
 
 typedef struct {
@@ -103,30 +137,96 @@ typedef struct {
     char error_buf[SHP_ERROR_SIZE];
     shx_file_t* shx;
     shp_header_t header;
+    unsigned char* record_buf;
+    size_t record_buf_size;
 } shp_file_t;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 shp_file_t* shp_open(const char* filename);
 int shp_valid(shp_file_t* shp);
 void shp_close(shp_file_t* shp);
+shx_file_t* shp_open_shx(shp_file_t* shp);
+uint32_t shp_n_records(shp_file_t* shp);
 size_t shp_read_pointz_record(shp_file_t* shp, shp_shape_pointz_record_t* dest, size_t n);
+int shp_read_shape(shp_file_t* shp, uint32_t shape_id, shp_shape_t* shape);
+int shp_read_shape_mapped(shp_file_t* shp, uint32_t shape_id, shp_shape_t* shape, char* error_buf);
+int shp_parse_shape(const unsigned char* content, uint32_t content_length,
+                    shp_shape_t* shape, char* error_buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+// Shapefile coordinates are always little endian; on little endian
+// platforms these compile to a single unaligned load.
+static inline double shp_le_double(const unsigned char* ptr) {
+    double value;
+#ifdef IS_BIG_ENDIAN
+    unsigned char swapped[8];
+    for (int i = 0; i < 8; i++) {
+        swapped[i] = ptr[7 - i];
+    }
+    memcpy(&value, swapped, sizeof(double));
+#else
+    memcpy(&value, ptr, sizeof(double));
+#endif
+    return value;
+}
+
+static inline uint32_t shp_le_uint32(const unsigned char* ptr) {
+    return ((uint32_t) ptr[0]) |
+        (((uint32_t) ptr[1]) << 8) |
+        (((uint32_t) ptr[2]) << 16) |
+        (((uint32_t) ptr[3]) << 24);
+}
+
+static inline uint32_t shp_be_uint32(const unsigned char* ptr) {
+    return ((uint32_t) ptr[3]) |
+        (((uint32_t) ptr[2]) << 8) |
+        (((uint32_t) ptr[1]) << 16) |
+        (((uint32_t) ptr[0]) << 24);
+}
+
+// Measure values less than -10^38 are "no data" according to the spec
+static inline int shp_measure_is_nodata(double value) {
+    return value < -1e38;
+}
+
+static inline int shp_shape_type_has_z(uint32_t shape_type) {
+    return (shape_type == SHP_TYPE_POINTZ) ||
+        (shape_type == SHP_TYPE_POLYLINEZ) ||
+        (shape_type == SHP_TYPE_POLYGONZ) ||
+        (shape_type == SHP_TYPE_MULTIPOINTZ) ||
+        (shape_type == SHP_TYPE_MULTIPATCH);
+}
+
+static inline int shp_shape_type_has_m(uint32_t shape_type) {
+    return (shape_type == SHP_TYPE_POINTM) ||
+        (shape_type == SHP_TYPE_POLYLINEM) ||
+        (shape_type == SHP_TYPE_POLYGONM) ||
+        (shape_type == SHP_TYPE_MULTIPOINTM);
+}
 
 #ifdef MINISHP_IMPL
 
-#include "minishp-port.h"
 #include <stdlib.h>
 #include <memory.h>
 
 shp_file_t* shp_open(const char* filename) {
     shp_file_t* shp = (shp_file_t*) malloc(sizeof(shp_file_t));
     memset(shp->error_buf, 0, SHP_ERROR_SIZE);
-    shp->file = minishp_file_default();
     shp->shx = NULL;
+    shp->record_buf = NULL;
+    shp->record_buf_size = 0;
 
     int filename_len = strlen(filename) + 1;
     shp->shp_filename = (char*) malloc(filename_len);
     memcpy(shp->shp_filename, filename, filename_len * sizeof(char));
 
-    shp->file_handle = shp->file.fopen(filename, "rb");
+    shp->file_handle = minishp_file_open_best(&shp->file, filename);
     if (shp->file_handle == NULL) {
         snprintf(shp->error_buf, SHP_ERROR_SIZE, "Failed to open shp file '%s'", filename);
         return shp;
@@ -143,6 +243,9 @@ shp_file_t* shp_open(const char* filename) {
 #ifdef IS_LITTLE_ENDIAN
     shp->header.file_code = bswap_32(shp->header.file_code);
     shp->header.file_length = bswap_32(shp->header.file_length);
+#else
+    shp->header.version = bswap_32(shp->header.version);
+    shp->header.shape_type = bswap_32(shp->header.shape_type);
 #endif
 
     if (shp->header.file_code != 9994) {
@@ -178,6 +281,7 @@ void shp_close(shp_file_t* shp) {
         if (shp->shx != NULL) {
             shx_close(shp->shx);
         }
+        free(shp->record_buf);
         free(shp->shp_filename);
         free(shp);
     }
@@ -187,14 +291,15 @@ shx_file_t* shp_open_shx(shp_file_t* shp) {
     if (shp->shx == NULL) {
         int filename_len = strlen(shp->shp_filename) + 1;
         char* shx_filename = (char*) malloc(filename_len);
+        memcpy(shx_filename, shp->shp_filename, filename_len);
 
         // Should be able to apply a more exhaustive set of checks
         // here for the name of the .shx file (this only covers
         // SHP -> SHX and shp->shx)
-        if (shp->shp_filename[filename_len - 2] == 'S') {
-            shx_filename[filename_len] = 'X';
+        if (shp->shp_filename[filename_len - 2] == 'P') {
+            shx_filename[filename_len - 2] = 'X';
         } else {
-            shx_filename[filename_len] = 'x';
+            shx_filename[filename_len - 2] = 'x';
         }
 
         shx_file_t* shx = shx_open(shx_filename);
@@ -214,24 +319,28 @@ shx_file_t* shp_open_shx(shp_file_t* shp) {
 void shp_close_shx(shp_file_t* shp) {
     if (shp->shx != NULL) {
         shx_close(shp->shx);
+        shp->shx = NULL;
     }
 }
 
+uint32_t shp_n_records(shp_file_t* shp) {
+    shx_file_t* shx = shp_open_shx(shp);
+    if (!shx_valid(shx)) {
+        return 0;
+    }
+
+    return shx_n_records(shx);
+}
+
 int shp_seek_words_abs(shp_file_t* shp, uint32_t words) {
-    return shp->file.fseek(shp->file_handle, words * 2, SEEK_SET);
+    return shp->file.fseek(shp->file_handle, ((int64_t) words) * 2, SEEK_SET);
 }
 
 int shp_seek_words_rel(shp_file_t* shp, int words) {
-    return shp->file.fseek(shp->file_handle, words * 2, SEEK_CUR);
+    return shp->file.fseek(shp->file_handle, ((int64_t) words) * 2, SEEK_CUR);
 }
 
 int shp_seek_shape_abs(shp_file_t* shp, uint32_t shape_id) {
-    size_t offset;
-    if (shape_id == 0) {
-        offset = sizeof(shp_header_t);
-        return 0;
-    }
-
     shx_file_t* shx = shp_open_shx(shp);
     if (!shx_valid(shx)) {
         return 1;
@@ -248,7 +357,7 @@ int shp_seek_shape_abs(shp_file_t* shp, uint32_t shape_id) {
 
 size_t shp_read_pointz_record(shp_file_t* shp, shp_shape_pointz_record_t* dest, size_t n) {
     // in case of error, attempt to leave cursor at the start of a record
-    long offset = shp->file.ftell(shp->file_handle);
+    int64_t offset = shp->file.ftell(shp->file_handle);
 
     size_t n_read = shp->file.fread(
         dest, 
@@ -279,6 +388,243 @@ size_t shp_read_pointz_record(shp_file_t* shp, shp_shape_pointz_record_t* dest,
     return n_read;
 }
 
+int shp_read_shape(shp_file_t* shp, uint32_t shape_id, shp_shape_t* shape) {
+    shx_file_t* shx = shp_open_shx(shp);
+    if (!shx_valid(shx)) {
+        return 1;
+    }
+
+    shx_record_t* record = shx_record(shx, shape_id);
+    if (record == NULL) {
+        snprintf(shp->error_buf, SHP_ERROR_SIZE, "Failed to find shape id %u in .shx", shape_id);
+        return 1;
+    }
+
+    // the .shx content length is in 16-bit words and doesn't include the
+    // 8-byte record header
+    int64_t offset = ((int64_t) record->offset) * 2;
+    size_t record_size = 8 + ((size_t) record->content_length) * 2;
+    const unsigned char* record_buf = NULL;
+
+    // if the file is mapped into memory, point directly to the record
+    if (shp->file.fdata != NULL) {
+        record_buf = shp->file.fdata(shp->file_handle, offset, record_size);
+    }
+
+    if (record_buf == NULL) {
+        if (record_size > shp->record_buf_size) {
+            unsigned char* new_buf = (unsigned char*) realloc(shp->record_buf, record_size);
+            if (new_buf == NULL) {
+                snprintf(shp->error_buf, SHP_ERROR_SIZE, "Failed to allocate record buffer of size %lu",
+                         (unsigned long) record_size);
+                return 1;
+            }
+
+            shp->record_buf = new_buf;
+            shp->record_buf_size = record_size;
+        }
+
+        if (shp->file.fseek(shp->file_handle, offset, SEEK_SET) != 0) {
+            snprintf(shp->error_buf, SHP_ERROR_SIZE, "Failed to seek to shape id %u", shape_id);
+            return 1;
+        }
+
+        size_t n_read = shp->file.fread(shp->record_buf, 1, record_size, shp->file_handle);
+        if (n_read != record_size) {
+            snprintf(
+                shp->error_buf, SHP_ERROR_SIZE,
+                "Expected %lu bytes for shape id %u but read %lu",
+                (unsigned long) record_size, shape_id, (unsigned long) n_read
+            );
+            return 1;
+        }
+
+        record_buf = shp->record_buf;
+    }
+
+    if (shp_parse_shape(record_buf + 8, record_size - 8, shape, shp->error_buf) != 0) {
+        return 1;
+    }
+
+    shape->record_number = shp_be_uint32(record_buf);
+    return 0;
+}
+
+// Like shp_read_shape() but safe to call from several threads at once: the
+// .shp must be memory-mapped and the .shx loaded with shx_load() (this
+// function never reads from a file or modifies the handle). Errors are
+// written to error_buf instead of the handle's error buffer.
+int shp_read_shape_mapped(shp_file_t* shp, uint32_t shape_id, shp_shape_t* shape, char* error_buf) {
+    if ((shp->file.fdata == NULL) || (shp->shx == NULL) || (shp->shx->table == NULL)) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Can't read shape id %u without a mapped .shp and loaded .shx", shape_id);
+        return 1;
+    }
+
+    if (shape_id >= shp->shx->n_records) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Failed to find shape id %u in .shx", shape_id);
+        return 1;
+    }
+
+    shx_record_t* record = shp->shx->table + shape_id;
+    int64_t offset = ((int64_t) record->offset) * 2;
+    size_t record_size = 8 + ((size_t) record->content_length) * 2;
+    const unsigned char* record_buf = shp->file.fdata(shp->file_handle, offset, record_size);
+    if (record_buf == NULL) {
+        snprintf(
+            error_buf, SHP_ERROR_SIZE,
+            "Expected %lu bytes for shape id %u beyond the end of the file",
+            (unsigned long) record_size, shape_id
+        );
+        return 1;
+    }
+
+    if (shp_parse_shape(record_buf + 8, record_size - 8, shape, error_buf) != 0) {
+        return 1;
+    }
+
+    shape->record_number = shp_be_uint32(record_buf);
+    return 0;
+}
+
+// https://www.esri.com/Library/Whitepapers/Pdfs/Shapefile.pdf, pages 4-15
+// `content` is the record content (i.e., starting at the shape type). Measures
+// are optional for all shape types that can have them: like shapelib, we consider
+// them present if the content is long enough to contain them.
+int shp_parse_shape(const unsigned char* content, uint32_t content_length,
+                    shp_shape_t* shape, char* error_buf) {
+    memset(shape, 0, sizeof(shp_shape_t));
+    shape->content_length = content_length;
+
+    if (content_length < 4) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Record too small to contain a shape type");
+        return 1;
+    }
+
+    shape->shape_type = shp_le_uint32(content);
+    uint32_t offset = 4;
+
+    switch (shape->shape_type) {
+    case SHP_TYPE_NULL:
+        return 0;
+
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+        if ((offset + 16 + (shape->shape_type == SHP_TYPE_POINTZ) * 8) > content_length) {
+            snprintf(error_buf, SHP_ERROR_SIZE, "Point record too small (%u bytes)", content_length);
+            return 1;
+        }
+
+        shape->n_points = 1;
+        shape->xy = content + offset;
+        offset += 16;
+
+        if (shape->shape_type == SHP_TYPE_POINTZ) {
+            shape->z = content + offset;
+            offset += 8;
+        }
+
+        if ((offset + 8) <= content_length) {
+            shape->m = content + offset;
+        }
+
+        return 0;
+
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+        if ((offset + 32 + 4) > content_length) {
+            snprintf(error_buf, SHP_ERROR_SIZE, "MultiPoint record too small (%u bytes)", content_length);
+            return 1;
+        }
+
+        shape->bounds = content + offset;
+        shape->n_points = shp_le_uint32(content + offset + 32);
+        offset += 32 + 4;
+        break;
+
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+    case SHP_TYPE_MULTIPATCH:
+        if ((offset + 32 + 8) > content_length) {
+            snprintf(error_buf, SHP_ERROR_SIZE, "Record too small (%u bytes)", content_length);
+            return 1;
+        }
+
+        shape->bounds = content + offset;
+        shape->n_parts = shp_le_uint32(content + offset + 32);
+        shape->n_points = shp_le_uint32(content + offset + 36);
+        offset += 32 + 8;
+
+        if ((shape->n_parts > (content_length / 4)) ||
+            ((offset + (uint64_t) shape->n_parts * 4) > content_length)) {
+            snprintf(error_buf, SHP_ERROR_SIZE, "Record too small for %u parts", shape->n_parts);
+            return 1;
+        }
+
+        shape->parts = content + offset;
+        offset += shape->n_parts * 4;
+
+        if (shape->shape_type == SHP_TYPE_MULTIPATCH) {
+            if ((offset + (uint64_t) shape->n_parts * 4) > content_length) {
+                snprintf(error_buf, SHP_ERROR_SIZE, "Record too small for %u part types", shape->n_parts);
+                return 1;
+            }
+
+            shape->part_types = content + offset;
+            offset += shape->n_parts * 4;
+        }
+
+        break;
+
+    default:
+        snprintf(error_buf, SHP_ERROR_SIZE, "Unsupported shape type %u", shape->shape_type);
+        return 1;
+    }
+
+    // the remainder is the same for all multi-vertex shapes
+    if ((shape->n_points > (content_length / 16)) ||
+        ((offset + (uint64_t) shape->n_points * 16) > content_length)) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Record too small for %u points", shape->n_points);
+        return 1;
+    }
+
+    shape->xy = content + offset;
+    offset += shape->n_points * 16;
+
+    if (shp_shape_type_has_z(shape->shape_type)) {
+        if ((offset + 16 + (uint64_t) shape->n_points * 8) > content_length) {
+            snprintf(error_buf, SHP_ERROR_SIZE, "Record too small for %u Z values", shape->n_points);
+            return 1;
+        }
+
+        shape->z_range = content + offset;
+        shape->z = content + offset + 16;
+        offset += 16 + shape->n_points * 8;
+    }
+
+    if ((offset + 16 + (uint64_t) shape->n_points * 8) <= content_length) {
+        shape->m_range = content + offset;
+        shape->m = content + offset + 16;
+    }
+
+    // check that part offsets are valid here so that consumers don't have to
+    for (uint32_t i = 0; i < shape->n_parts; i++) {
+        uint32_t part_start = shp_le_uint32(shape->parts + i * 4);
+        if ((part_start > shape->n_points) ||
+            ((i > 0) && (part_start < shp_le_uint32(shape->parts + (i - 1) * 4)))) {
+            snprintf(error_buf, SHP_ERROR_SIZE, "Invalid start index for part %u", i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 #endif
 
 #endif
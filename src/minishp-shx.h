@@ -12,20 +12,58 @@
 
 #define SHX_ERROR_SIZE 1024
 
+// Unless the whole .shx is loaded with shx_load(), records are cached in
+// two ways: a read-ahead window that doubles in size (up to cache_size
+// records) while records are accessed in increasing order, and a small
+// LRU cache of fixed-size pages for everything else.
+#define SHX_MIN_READ_AHEAD 64
+#define SHX_MAX_READ_AHEAD 65536
+#define SHX_PAGE_SIZE 64
+#define SHX_N_PAGES 64
+
+// shx_load_if_dense() loads the whole .shx when at least
+// 1 / SHX_LOAD_FRACTION of its records will be requested, which is
+// cheaper than reading them through the caches
+#define SHX_LOAD_FRACTION 8
+
 typedef struct {
     uint32_t offset;
     uint32_t content_length;
 } shx_record_t;
 
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint64_t last_used;
+    shx_record_t* records;
+} shx_page_t;
+
+typedef struct {
+    uint64_t n_hits;
+    uint64_t n_misses;
+    uint64_t n_records_read;
+} shx_cache_stats_t;
+
 typedef struct {
     void* file_handle;
     minishp_file_t file;
     char error_buf[SHX_ERROR_SIZE];
     uint32_t n_records;
+    // the maximum read-ahead (in records)
     uint32_t cache_size;
+    uint32_t read_ahead;
+    uint32_t last_shape_id;
     uint32_t cache_start;
     uint32_t cache_end;
+    uint32_t cache_capacity;
     shx_record_t* cache;
+    shx_page_t pages[SHX_N_PAGES];
+    shx_record_t* page_data;
+    uint64_t clock;
+    shx_cache_stats_t stats;
+    // all records in native byte order (or NULL if shx_load() hasn't
+    // been called)
+    shx_record_t* table;
 } shx_file_t;
 
 #ifdef __cplusplus
@@ -36,6 +74,9 @@ shx_file_t* shx_open(const char* filename);
 void shx_set_cache_size(shx_file_t* shx, size_t cache_size);
 int shx_valid(shx_file_t* shx);
 uint32_t shx_n_records(shx_file_t* shx);
+int shx_load(shx_file_t* shx);
+int shx_load_if_dense(shx_file_t* shx, uint64_t n_requested);
+shx_cache_stats_t shx_cache_stats(shx_file_t* shx);
 size_t shx_record_n(shx_file_t* shx, shx_record_t* dest, uint32_t shape_id, size_t n);
 shx_record_t* shx_record(shx_file_t* shx, uint32_t shape_id);
 void shx_close(shx_file_t* shx);
@@ -59,13 +100,25 @@ shx_file_t* shx_open(const char* filename) {
     shx_file_t* shx = (shx_file_t*) malloc(sizeof(shx_file_t));
     memset(shx->error_buf, 0, SHX_ERROR_SIZE);
     shx->n_records = UINT32_MAX;
-    shx->file = minishp_file_default();
-    shx->cache_size = 64;
+    shx->cache_size = SHX_MAX_READ_AHEAD;
+    shx->read_ahead = SHX_MIN_READ_AHEAD;
+    shx->last_shape_id = UINT32_MAX;
     shx->cache_start = UINT32_MAX;
     shx->cache_end = UINT32_MAX;
-    shx->cache = malloc(sizeof(shx_record_t) * shx->cache_size);
+    shx->cache_capacity = 0;
+    shx->cache = NULL;
+    for (int i = 0; i < SHX_N_PAGES; i++) {
+        shx->pages[i].start = UINT32_MAX;
+        shx->pages[i].end = UINT32_MAX;
+        shx->pages[i].last_used = 0;
+        shx->pages[i].records = NULL;
+    }
+    shx->page_data = NULL;
+    shx->clock = 0;
+    memset(&shx->stats, 0, sizeof(shx_cache_stats_t));
+    shx->table = NULL;
 
-    shx->file_handle = shx->file.fopen(filename, "rb");
+    shx->file_handle = minishp_file_open_best(&shx->file, filename);
     if (shx->file_handle == NULL) {
         snprintf(shx->error_buf, SHX_ERROR_SIZE, "Failed to open shx file '%s'", filename);
     }
@@ -73,19 +126,22 @@ shx_file_t* shx_open(const char* filename) {
     return shx;
 }
 
+// Sets the maximum number of records read ahead when records are accessed
+// in increasing order
 void shx_set_cache_size(shx_file_t* shx, size_t cache_size) {
-    size_t previous = shx->cache_size;
     if (cache_size >= 1) {
-        shx->cache_size = cache_size;
+        shx->cache_size = cache_size < UINT32_MAX ? (uint32_t) cache_size : UINT32_MAX - 1;
     } else {
         shx->cache_size = 1;
     }
 
-    if (shx->cache_size != previous) {
+    if (shx->read_ahead > shx->cache_size) {
+        shx->read_ahead = shx->cache_size;
+    }
+
+    if ((shx->cache_end - shx->cache_start) > shx->cache_size) {
         shx->cache_start = UINT32_MAX;
         shx->cache_end = UINT32_MAX;
-        free(shx->cache);
-        shx->cache = malloc(sizeof(shx_record_t) * shx->cache_size);
     }
 }
 
@@ -96,8 +152,12 @@ int shx_valid(shx_file_t* shx) {
 uint32_t shx_n_records(shx_file_t* shx) {
     if (shx_valid(shx) && (shx->n_records == UINT32_MAX)) {
         shx->file.fseek(shx->file_handle, 0, SEEK_END);
-        size_t shx_size = shx->file.ftell(shx->file_handle);
-        shx->n_records = (shx_size - SHX_HEADER_SIZE) / sizeof(shx_record_t);
+        int64_t shx_size = shx->file.ftell(shx->file_handle);
+        if (shx_size < SHX_HEADER_SIZE) {
+            shx->n_records = 0;
+        } else {
+            shx->n_records = (shx_size - SHX_HEADER_SIZE) / sizeof(shx_record_t);
+        }
     }
 
     return shx->n_records;
@@ -108,13 +168,28 @@ size_t shx_record_n(shx_file_t* shx, shx_record_t* dest, uint32_t shape_id, size
         return 0;
     }
 
-    size_t shx_offset = SHX_HEADER_SIZE + sizeof(shx_record_t) * shape_id;
-    if (shx->file.fseek(shx->file_handle, shx_offset, SEEK_SET) != 0) {
-        snprintf(shx->error_buf, SHX_ERROR_SIZE, "Can't find shape_id '%u' in .shx", shape_id);
-        return 0;
+    int64_t shx_offset = SHX_HEADER_SIZE + ((int64_t) sizeof(shx_record_t)) * shape_id;
+    size_t n_read;
+
+    // if the records are mapped into memory, avoid the fseek() + fread()
+    const unsigned char* data = NULL;
+    if ((shx->file.fdata != NULL) && (shape_id < shx_n_records(shx))) {
+        size_t n_available = shx_n_records(shx) - shape_id;
+        n_read = n < n_available ? n : n_available;
+        data = shx->file.fdata(shx->file_handle, shx_offset, sizeof(shx_record_t) * n_read);
+    }
+
+    if (data != NULL) {
+        memcpy(dest, data, sizeof(shx_record_t) * n_read);
+    } else {
+        if (shx->file.fseek(shx->file_handle, shx_offset, SEEK_SET) != 0) {
+            snprintf(shx->error_buf, SHX_ERROR_SIZE, "Can't find shape_id '%u' in .shx", shape_id);
+            return 0;
+        }
+
+        n_read = shx->file.fread(dest, sizeof(shx_record_t), n, shx->file_handle);
     }
 
-    size_t n_read = shx->file.fread(dest, sizeof(shx_record_t), n, shx->file_handle);
     if (n_read != n) {
         snprintf(
             shx->error_buf, SHX_ERROR_SIZE, 
@@ -132,24 +207,196 @@ size_t shx_record_n(shx_file_t* shx, shx_record_t* dest, uint32_t shape_id, size
     return n_read;
 }
 
+// Reads every record into memory with a single read so that subsequent
+// calls to shx_record() are an array lookup. Returns 0 on success.
+int shx_load(shx_file_t* shx) {
+    if (!shx_valid(shx)) {
+        return 1;
+    }
+
+    if (shx->table != NULL) {
+        return 0;
+    }
+
+    // (allocate at least one record so that an empty .shx still has a table)
+    uint32_t n_records = shx_n_records(shx);
+    shx_record_t* table = (shx_record_t*) malloc(sizeof(shx_record_t) * ((size_t) n_records + 1));
+    if (table == NULL) {
+        snprintf(
+            shx->error_buf, SHX_ERROR_SIZE,
+            "Failed to allocate %u records from .shx", n_records
+        );
+        return 1;
+    }
+
+    size_t table_size = sizeof(shx_record_t) * n_records;
+    const unsigned char* data = NULL;
+    if (shx->file.fdata != NULL) {
+        data = shx->file.fdata(shx->file_handle, SHX_HEADER_SIZE, table_size);
+    }
+
+    if (data != NULL) {
+        memcpy(table, data, table_size);
+    } else if (shx->file.fseek(shx->file_handle, SHX_HEADER_SIZE, SEEK_SET) != 0 ||
+               shx->file.fread(table, 1, table_size, shx->file_handle) != table_size) {
+        snprintf(
+            shx->error_buf, SHX_ERROR_SIZE,
+            "Expected %u records in .shx but failed to read them", n_records
+        );
+        free(table);
+        return 1;
+    }
+
+#ifdef IS_LITTLE_ENDIAN
+    minishp_bswap_32_n((uint32_t*) table, ((size_t) n_records) * 2);
+#endif
+
+    shx->table = table;
+    return 0;
+}
+
+// Returns 0 on success (including when the .shx isn't loaded because
+// too few records will be requested)
+int shx_load_if_dense(shx_file_t* shx, uint64_t n_requested) {
+    if (!shx_valid(shx)) {
+        return 1;
+    }
+
+    if ((n_requested * SHX_LOAD_FRACTION) >= shx_n_records(shx)) {
+        return shx_load(shx);
+    }
+
+    return 0;
+}
+
+shx_cache_stats_t shx_cache_stats(shx_file_t* shx) {
+    return shx->stats;
+}
+
+static shx_record_t* shx_fill_window(shx_file_t* shx, uint32_t shape_id) {
+    if (shx->cache_capacity < shx->read_ahead) {
+        shx_record_t* new_cache = (shx_record_t*) realloc(shx->cache, sizeof(shx_record_t) * shx->read_ahead);
+        if (new_cache == NULL) {
+            snprintf(shx->error_buf, SHX_ERROR_SIZE, "Failed to allocate .shx cache");
+            return NULL;
+        }
+
+        shx->cache = new_cache;
+        shx->cache_capacity = shx->read_ahead;
+    }
+
+    uint32_t n_available = shx_n_records(shx) - shape_id;
+    size_t n = shx->read_ahead < n_available ? shx->read_ahead : n_available;
+    size_t n_read = shx_record_n(shx, shx->cache, shape_id, n);
+    shx->stats.n_records_read += n_read;
+    if (n_read == 0) {
+        shx->cache_start = UINT32_MAX;
+        shx->cache_end = UINT32_MAX;
+        return NULL;
+    }
+
+    shx->cache_start = shape_id;
+    shx->cache_end = shape_id + n_read;
+    return shx->cache;
+}
+
+static shx_record_t* shx_fill_page(shx_file_t* shx, uint32_t shape_id) {
+    if (shx->page_data == NULL) {
+        shx->page_data = (shx_record_t*) malloc(sizeof(shx_record_t) * SHX_PAGE_SIZE * SHX_N_PAGES);
+        if (shx->page_data == NULL) {
+            snprintf(shx->error_buf, SHX_ERROR_SIZE, "Failed to allocate .shx cache");
+            return NULL;
+        }
+
+        for (int i = 0; i < SHX_N_PAGES; i++) {
+            shx->pages[i].records = shx->page_data + i * SHX_PAGE_SIZE;
+        }
+    }
+
+    // reuse the least recently used page (unused pages have last_used 0)
+    shx_page_t* page = shx->pages;
+    for (int i = 1; i < SHX_N_PAGES; i++) {
+        if (shx->pages[i].last_used < page->last_used) {
+            page = shx->pages + i;
+        }
+    }
+
+    uint32_t page_start = shape_id - (shape_id % SHX_PAGE_SIZE);
+    uint32_t n_available = shx_n_records(shx) - page_start;
+    size_t n = SHX_PAGE_SIZE < n_available ? SHX_PAGE_SIZE : n_available;
+    size_t n_read = shx_record_n(shx, page->records, page_start, n);
+    shx->stats.n_records_read += n_read;
+    if (n_read <= (shape_id - page_start)) {
+        page->start = UINT32_MAX;
+        page->end = UINT32_MAX;
+        page->last_used = 0;
+        return NULL;
+    }
+
+    page->start = page_start;
+    page->end = page_start + n_read;
+    page->last_used = ++shx->clock;
+    return page->records + (shape_id - page_start);
+}
+
 shx_record_t* shx_record(shx_file_t* shx, uint32_t shape_id) {
     if (shape_id >= shx_n_records(shx)) {
         return NULL;
     }
-    
-    if ((shape_id < shx->cache_start) || (shape_id >= shx->cache_end)) {
-        size_t n_read = shx_record_n(shx, shx->cache, shape_id, shx->cache_size);
-        shx->cache_start = shape_id;
-        shx->cache_end = shape_id + n_read;
+
+    if (shx->table != NULL) {
+        return shx->table + shape_id;
+    }
+
+    uint32_t last_shape_id = shx->last_shape_id;
+    shx->last_shape_id = shape_id;
+
+    if ((shape_id >= shx->cache_start) && (shape_id < shx->cache_end)) {
+        shx->stats.n_hits++;
+        return shx->cache + (shape_id - shx->cache_start);
+    }
+
+    for (int i = 0; i < SHX_N_PAGES; i++) {
+        shx_page_t* page = shx->pages + i;
+        if ((shape_id >= page->start) && (shape_id < page->end)) {
+            shx->stats.n_hits++;
+            page->last_used = ++shx->clock;
+            return page->records + (shape_id - page->start);
+        }
+    }
+
+    shx->stats.n_misses++;
+
+    // A miss shortly after the previous shape_id means records are being
+    // read in increasing order (possibly skipping some): read further
+    // ahead each time. Anything else is random access, which is better
+    // served by small pages that don't evict the read-ahead window.
+    int sequential = (last_shape_id == UINT32_MAX) ||
+        ((shape_id > last_shape_id) && ((shape_id - last_shape_id) <= shx->read_ahead));
+
+    if (!sequential) {
+        shx->read_ahead = SHX_MIN_READ_AHEAD < shx->cache_size ? SHX_MIN_READ_AHEAD : shx->cache_size;
+        return shx_fill_page(shx, shape_id);
+    }
+
+    if ((last_shape_id != UINT32_MAX) && (shx->read_ahead < shx->cache_size)) {
+        uint64_t read_ahead = ((uint64_t) shx->read_ahead) * 2;
+        shx->read_ahead = read_ahead < shx->cache_size ? (uint32_t) read_ahead : shx->cache_size;
+    }
+
+    if (shx_fill_window(shx, shape_id) == NULL) {
+        return NULL;
     }
 
-    return shx->cache + (shape_id - shx->cache_start);
+    return shx->cache;
 }
 
 void shx_close(shx_file_t* shx) {
     if (shx != NULL) {
         shx->file.fclose(shx->file_handle);
         free(shx->cache);
+        free(shx->page_data);
+        free(shx->table);
         free(shx);
     }
 }
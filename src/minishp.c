@@ -3,3 +3,4 @@
 #include "minishp-file.h"
 #include "minishp-shx.h"
 #include "minishp-shp.h"
+#include "minishp-rtx.h"
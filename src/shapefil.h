@@ -632,6 +632,11 @@ typedef struct
     int         nUpdateDay; /* 1-31 */
 
     int         bWriteEndOfFileChar; /* defaults to TRUE */
+
+    char        *pszReadBlock; /* Read-ahead buffer of whole records */
+    int         nReadBlockSize; /* Byte budget of pszReadBlock, 0 if disabled */
+    int         nReadBlockFirstRecord;
+    int         nReadBlockRecords; /* Number of valid records in pszReadBlock */
 } DBFInfo;
 
 typedef DBFInfo * DBFHandle;
@@ -726,6 +731,8 @@ int SHPAPI_CALL
                                void * pValue );
 const char SHPAPI_CALL1(*)
       DBFReadTuple(DBFHandle psDBF, int hEntity );
+const char SHPAPI_CALL1(*)
+      DBFReadTupleView(DBFHandle psDBF, int hEntity );
 int SHPAPI_CALL
       DBFWriteTuple(DBFHandle psDBF, int hEntity, void * pRawTuple );
 
@@ -751,6 +758,8 @@ void SHPAPI_CALL
 
 void SHPAPI_CALL DBFSetWriteEndOfFileChar( DBFHandle psDBF, int bWriteFlag );
 
+void SHPAPI_CALL DBFSetReadBlockSize( DBFHandle psDBF, int nBlockSize );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,256 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <R.h>
+#include <Rinternals.h>
+#include "shapefil.h"
+#include "shp-file-cache.h"
+#include "minishp-rtx.h"
+
+// Replace the last three characters of a .shp filename (keeping the
+// case of the original extension)
+static void shp_sidecar_filename(char* dest, const char* filename, const char* ext) {
+    size_t len = strlen(filename);
+    memcpy(dest, filename, len + 1);
+    if (len < 3) {
+        return;
+    }
+
+    int upper = filename[len - 1] == 'P';
+    for (int i = 0; i < 3; i++) {
+        dest[len - 3 + i] = upper ? (ext[i] - 'a' + 'A') : ext[i];
+    }
+}
+
+static int shp_compare_int(const void* a, const void* b) {
+    int int_a = *((const int*) a);
+    int int_b = *((const int*) b);
+    return (int_a > int_b) - (int_a < int_b);
+}
+
+// Shape ids from an .rtx (packed R-tree) index. Unlike the .qix and
+// .sbn, the leaves of an .rtx contain the exact record bounds and null
+// shapes are not indexed, so the result doesn't have to be refined.
+// Returns NULL (and the caller should try another index) if there is no
+// .rtx or if it was built from a different version of the .shp.
+static int* shp_bbox_rtx_result(const char* filename, double* bounds_min, double* bounds_max,
+                                int n_features, int* n_result) {
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return NULL;
+    }
+
+    char* sidecar = (char*) malloc(strlen(filename) + 1);
+    if (sidecar == NULL) {
+        return NULL;
+    }
+
+    shp_sidecar_filename(sidecar, filename, "rtx");
+    rtx_file_t* rtx = rtx_open(sidecar);
+    free(sidecar);
+
+    if (!rtx_valid(rtx) ||
+        rtx->header.n_features != (uint32_t) n_features ||
+        rtx->header.shp_size != (uint64_t) st.st_size) {
+        rtx_close(rtx);
+        return NULL;
+    }
+
+    uint32_t n_found;
+    uint32_t* ids = rtx_search(
+        rtx,
+        bounds_min[0], bounds_min[1], bounds_max[0], bounds_max[1],
+        &n_found
+    );
+    rtx_close(rtx);
+    if (ids == NULL) {
+        return NULL;
+    }
+
+    // ids are in Hilbert order
+    int* result = (int*) ids;
+    *n_result = 0;
+    for (uint32_t i = 0; i < n_found; i++) {
+        if (ids[i] < (uint32_t) n_features) {
+            result[(*n_result)++] = (int) ids[i];
+        }
+    }
+
+    qsort(result, *n_result, sizeof(int), &shp_compare_int);
+    return result;
+}
+
+// Candidate shape ids from a .qix (quadtree) or .sbn (ESRI spatial bin)
+// index. Both are allowed to return shapes that don't intersect the
+// query (the index nodes are coarser than the shapes), so candidates
+// still have to be checked against the record bounds. Returns NULL if
+// neither sidecar is present (or neither can be searched), in which case
+// every record is a candidate.
+static int* shp_bbox_index_candidates(const char* filename, double* bounds_min,
+                                      double* bounds_max, int* n_candidates,
+                                      const char** index_type) {
+    char* sidecar = (char*) malloc(strlen(filename) + 1);
+    if (sidecar == NULL) {
+        return NULL;
+    }
+
+    int* candidates = NULL;
+
+    shp_sidecar_filename(sidecar, filename, "qix");
+    SHPTreeDiskHandle hQIX = SHPOpenDiskTree(sidecar, NULL);
+    if (hQIX != NULL) {
+        candidates = SHPSearchDiskTreeEx(hQIX, bounds_min, bounds_max, n_candidates);
+        SHPCloseDiskTree(hQIX);
+        if (candidates != NULL) {
+            *index_type = "qix";
+            free(sidecar);
+            return candidates;
+        }
+    }
+
+    shp_sidecar_filename(sidecar, filename, "sbn");
+    SBNSearchHandle hSBN = SBNOpenDiskTree(sidecar, NULL);
+    if (hSBN != NULL) {
+        // SBNSearchDiskTree() returns NULL when the query doesn't overlap
+        // the extent of the index (i.e., there are no candidates) and
+        // SBNSearchFreeIds() must be used to free the ids it returns
+        int* sbn_candidates = SBNSearchDiskTree(hSBN, bounds_min, bounds_max, n_candidates);
+        SBNCloseDiskTree(hSBN);
+        candidates = (int*) malloc((*n_candidates + 1) * sizeof(int));
+        if (candidates != NULL) {
+            if (*n_candidates > 0) {
+                memcpy(candidates, sbn_candidates, *n_candidates * sizeof(int));
+            }
+
+            *index_type = "sbn";
+        } else {
+            *n_candidates = 0;
+        }
+
+        if (sbn_candidates != NULL) {
+            SBNSearchFreeIds(sbn_candidates);
+        }
+    }
+
+    free(sidecar);
+    return candidates;
+}
+
+// Returns 1 if the shape's bounds intersect the query, 0 if they don't
+// (or the shape is null)
+static int shp_shape_intersects_bbox(shp_shape_t* shape, double* bounds_min, double* bounds_max) {
+    double xmin, ymin, xmax, ymax;
+    if (shape->bounds != NULL) {
+        xmin = shp_le_double(shape->bounds);
+        ymin = shp_le_double(shape->bounds + 8);
+        xmax = shp_le_double(shape->bounds + 16);
+        ymax = shp_le_double(shape->bounds + 24);
+    } else if (shape->xy != NULL) {
+        xmin = xmax = shp_le_double(shape->xy);
+        ymin = ymax = shp_le_double(shape->xy + 8);
+    } else {
+        return 0;
+    }
+
+    return (xmin <= bounds_max[0]) && (xmax >= bounds_min[0]) &&
+        (ymin <= bounds_max[1]) && (ymax >= bounds_min[1]);
+}
+
+typedef struct {
+    SEXP path;
+    SEXP bbox;
+    int n_features;
+    shp_file_t* shp;
+    int* candidates;
+    int* result;
+} shp_bbox_query_t;
+
+static void shp_bbox_query_cleanup(void* data) {
+    shp_bbox_query_t* query = (shp_bbox_query_t*) data;
+    shp_file_cache_release(query->shp);
+    free(query->candidates);
+    free(query->result);
+}
+
+static SEXP shp_bbox_query_with_cleanup(void* data) {
+    shp_bbox_query_t* query = (shp_bbox_query_t*) data;
+    const char* filename = Rf_translateCharUTF8(STRING_ELT(query->path, 0));
+    double* bbox = REAL(query->bbox);
+    double bounds_min[4] = {bbox[0], bbox[1], 0, 0};
+    double bounds_max[4] = {bbox[2], bbox[3], 0, 0};
+
+    query->shp = shp_file_cache_acquire(filename);
+    if (!shp_valid(query->shp)) {
+        Rf_error("%s", query->shp->error_buf);
+    }
+
+    // A stale index may refer to shapes that no longer exist. The number of
+    // features is passed from R because the .shx may contain trailing bytes
+    // beyond the length recorded in its header.
+    int n_records = query->n_features;
+    int n_result = 0;
+
+    query->result = shp_bbox_rtx_result(filename, bounds_min, bounds_max, n_records, &n_result);
+    if (query->result != NULL) {
+        SEXP out = PROTECT(Rf_allocVector(INTSXP, n_result));
+        if (n_result > 0) {
+            memcpy(INTEGER(out), query->result, n_result * sizeof(int));
+        }
+
+        Rf_setAttrib(out, Rf_install("index"), Rf_mkString("rtx"));
+        UNPROTECT(1);
+        return out;
+    }
+
+    int n_candidates = 0;
+    const char* index_type = "scan";
+    query->candidates = shp_bbox_index_candidates(
+        filename, bounds_min, bounds_max,
+        &n_candidates, &index_type
+    );
+    if (query->candidates == NULL) {
+        n_candidates = n_records;
+    }
+
+    query->result = (int*) malloc((n_candidates + 1) * sizeof(int));
+    if (query->result == NULL) {
+        Rf_error("Failed to allocate result buffer of size %d", n_candidates);
+    }
+
+    int shape_id;
+    shp_shape_t shape;
+    for (int i = 0; i < n_candidates; i++) {
+        if ((i + 1) % 10000 == 0) R_CheckUserInterrupt();
+
+        shape_id = query->candidates == NULL ? i : query->candidates[i];
+        if (shape_id < 0 || shape_id >= n_records) {
+            continue;
+        }
+
+        if (shp_read_shape(query->shp, shape_id, &shape) != 0) {
+            Rf_error("[shape_id=%d] %s", shape_id, query->shp->error_buf);
+        }
+
+        if (shp_shape_intersects_bbox(&shape, bounds_min, bounds_max)) {
+            query->result[n_result++] = shape_id;
+        }
+    }
+
+    SEXP out = PROTECT(Rf_allocVector(INTSXP, n_result));
+    memcpy(INTEGER(out), query->result, n_result * sizeof(int));
+    Rf_setAttrib(out, Rf_install("index"), Rf_mkString(index_type));
+    UNPROTECT(1);
+    return out;
+}
+
+SEXP shp_c_bbox_query(SEXP path, SEXP bbox, SEXP n_features) {
+    shp_bbox_query_t query = {path, bbox, INTEGER(n_features)[0], NULL, NULL, NULL};
+    return R_ExecWithCleanup(
+        &shp_bbox_query_with_cleanup,
+        &query,
+        &shp_bbox_query_cleanup,
+        &query
+    );
+}
@@ -0,0 +1,10 @@
+#include <cpp11.hpp>
+#include <R_ext/Rdynload.h>
+
+extern "C" void shp_init_c_callables(DllInfo* dll);
+
+// Called from R_init_shp() (cpp11::cpp_register() generates the call)
+[[cpp11::init]]
+void shp_init_callables(DllInfo* dll) {
+    shp_init_c_callables(dll);
+}
@@ -0,0 +1,503 @@
+#include <cpp11.hpp>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+using namespace cpp11;
+
+// The write side of shp-dbf.cpp. A DBF file is a header, one 32-byte
+// descriptor per field, and fixed-width records of space-padded text. Because
+// the header can't change after the first record, each column gets a
+// FieldWriter that computes the field's type, width, and precision from the
+// whole R vector in a pre-pass. Records are then filled a block at a time,
+// one column at a time (each writer formats its values straight into the
+// block), and each block is written with one fwrite(). This avoids the
+// shapelib writer, which formats each value with snprintf() and loads and
+// flushes the record for every value written.
+//
+// Values are written as UTF-8 (with a .cpg file to say so). Numbers are
+// formatted without snprintf() whenever the exact value can be written with
+// at most 15 decimal places (which includes all integers and anything read
+// from a DBF file).
+
+// Records are written in blocks of (about) this many bytes
+#ifndef SHP_DBF_WRITE_BLOCK_SIZE
+#define SHP_DBF_WRITE_BLOCK_SIZE 1048576
+#endif
+
+#define DBF_MAX_DECIMALS 15
+
+// 2^53: every integer with a magnitude less than this is exact in a double
+#define DBF_MAX_EXACT_INTEGER 9007199254740992.0
+
+static const double dbf_pow10[DBF_MAX_DECIMALS + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+class DBFWriteFile {
+public:
+    DBFWriteFile(std::string filename): filename_(filename), fp(nullptr) {
+        fp = fopen(filename.c_str(), "wb");
+        if (fp == nullptr) {
+            std::stringstream err;
+            err << "Failed to create DBF file '" << filename << "'";
+            stop(err.str());
+        }
+    }
+
+    ~DBFWriteFile() {
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+    }
+
+    void write(const void* data, size_t size) {
+        if (fwrite(data, 1, size, fp) != size) {
+            std::stringstream err;
+            err << "Failed to write to '" << filename_ << "'";
+            stop(err.str());
+        }
+    }
+
+    void close() {
+        int result = fclose(fp);
+        fp = nullptr;
+        if (result != 0) {
+            std::stringstream err;
+            err << "Failed to close '" << filename_ << "'";
+            stop(err.str());
+        }
+    }
+
+private:
+    std::string filename_;
+    FILE* fp;
+};
+
+// Writes the digits of `value` ending just before `end` and returns a
+// pointer to the first digit
+static inline char* dbf_format_digits(uint64_t value, char* end) {
+    do {
+        *(--end) = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    return end;
+}
+
+static inline int dbf_n_digits(uint64_t value) {
+    int n = 1;
+    while (value >= 10) {
+        value /= 10;
+        n++;
+    }
+
+    return n;
+}
+
+// Writes `size` characters right-aligned in a field of `width`
+// characters (numeric fields are right-aligned)
+static inline void dbf_put_right(char* dest, int width, const char* value, int size) {
+    memset(dest, ' ', width - size);
+    memcpy(dest + width - size, value, size);
+}
+
+class FieldWriter {
+public:
+    FieldWriter(char type): type_(type), width_(1), decimals_(0) {}
+    virtual ~FieldWriter() {}
+
+    char type() { return type_; }
+    int width() { return width_; }
+    int decimals() { return decimals_; }
+
+    // Formats rows [start, end) into the field at `dest` of consecutive
+    // records that are `record_length` bytes apart
+    virtual void write(R_xlen_t start, R_xlen_t end, char* dest, int record_length) = 0;
+
+protected:
+    char type_;
+    int width_;
+    int decimals_;
+};
+
+class LogicalsWriter: public FieldWriter {
+public:
+    LogicalsWriter(SEXP x): FieldWriter('L'), data_(LOGICAL(x)) {}
+
+    void write(R_xlen_t start, R_xlen_t end, char* dest, int record_length) {
+        for (R_xlen_t i = start; i < end; i++, dest += record_length) {
+            if (data_[i] == NA_LOGICAL) {
+                *dest = '?';
+            } else {
+                *dest = data_[i] ? 'T' : 'F';
+            }
+        }
+    }
+
+private:
+    const int* data_;
+};
+
+class IntegersWriter: public FieldWriter {
+public:
+    IntegersWriter(SEXP x): FieldWriter('N'), data_(INTEGER(x)) {
+        R_xlen_t size = Rf_xlength(x);
+        for (R_xlen_t i = 0; i < size; i++) {
+            if (data_[i] != NA_INTEGER) {
+                int64_t value = data_[i];
+                int width = dbf_n_digits(value < 0 ? -value : value) + (value < 0);
+                width_ = std::max(width_, width);
+            }
+        }
+    }
+
+    void write(R_xlen_t start, R_xlen_t end, char* dest, int record_length) {
+        char buf[16];
+        char* buf_end = buf + sizeof(buf);
+        for (R_xlen_t i = start; i < end; i++, dest += record_length) {
+            if (data_[i] == NA_INTEGER) {
+                memset(dest, '*', width_);
+                continue;
+            }
+
+            int64_t value = data_[i];
+            char* first = dbf_format_digits(value < 0 ? -value : value, buf_end);
+            if (value < 0) {
+                *(--first) = '-';
+            }
+
+            dbf_put_right(dest, width_, first, buf_end - first);
+        }
+    }
+
+private:
+    const int* data_;
+};
+
+class DoublesWriter: public FieldWriter {
+public:
+    DoublesWriter(SEXP x, const std::string& name):
+        FieldWriter('N'), data_(REAL(x)), value_decimals_(Rf_xlength(x)) {
+        R_xlen_t size = Rf_xlength(x);
+        bool needs_snprintf = false;
+
+        // the fewest decimals that each value can be written with exactly
+        for (R_xlen_t i = 0; i < size; i++) {
+            if (!std::isfinite(data_[i])) {
+                value_decimals_[i] = 0;
+                continue;
+            }
+
+            value_decimals_[i] = exact_decimals(data_[i]);
+            if (value_decimals_[i] < 0) {
+                needs_snprintf = true;
+            } else {
+                decimals_ = std::max<int>(decimals_, value_decimals_[i]);
+            }
+        }
+
+        // Values that can't be written exactly are written with as many
+        // decimals as fit in a double
+        if (needs_snprintf) {
+            decimals_ = DBF_MAX_DECIMALS;
+        }
+
+        double round_up = needs_snprintf ? 0.5 / dbf_pow10[decimals_] : 0;
+        int int_width = 1;
+        for (R_xlen_t i = 0; i < size; i++) {
+            double value = data_[i];
+            if (!std::isfinite(value)) {
+                continue;
+            }
+
+            // (the integer part can gain a digit when rounded by snprintf())
+            double int_part = std::floor(std::fabs(value) + (value_decimals_[i] < 0 ? round_up : 0));
+            int digits;
+            if (int_part < DBF_MAX_EXACT_INTEGER) {
+                digits = dbf_n_digits((uint64_t) int_part);
+            } else {
+                digits = (int) std::floor(std::log10(int_part)) + 1;
+            }
+
+            int_width = std::max(int_width, digits + (value < 0));
+        }
+
+        width_ = int_width + (decimals_ > 0 ? decimals_ + 1 : 0);
+        if (width_ > 255) {
+            stop("Can't write values in column '%s' with more than 255 characters", name.c_str());
+        }
+    }
+
+    void write(R_xlen_t start, R_xlen_t end, char* dest, int record_length) {
+        // (up to 20 integer digits, a sign, a point, and 15 decimals)
+        char buf[40];
+        char* buf_end = buf + sizeof(buf);
+        std::vector<char> fallback(width_ + 1);
+
+        for (R_xlen_t i = start; i < end; i++, dest += record_length) {
+            double value = data_[i];
+            if (!std::isfinite(value)) {
+                memset(dest, '*', width_);
+                continue;
+            }
+
+            int value_decimals = value_decimals_[i];
+            if (value_decimals < 0) {
+                int size = snprintf(fallback.data(), width_ + 1, "%.*f", decimals_, value);
+                dbf_put_right(dest, width_, fallback.data(), std::min(size, width_));
+                continue;
+            }
+
+            // Write the value as an integer count of 10^-value_decimals and
+            // pad with zeros to the field's number of decimals
+            double scaled = std::round(std::fabs(value) * dbf_pow10[value_decimals]);
+            uint64_t digits = (uint64_t) scaled;
+            char* first = buf_end - (decimals_ - value_decimals);
+            memset(first, '0', decimals_ - value_decimals);
+
+            for (int j = 0; j < value_decimals; j++) {
+                *(--first) = '0' + (digits % 10);
+                digits /= 10;
+            }
+
+            if (decimals_ > 0) {
+                *(--first) = '.';
+            }
+
+            first = dbf_format_digits(digits, first);
+            if (std::signbit(value) && (scaled != 0)) {
+                *(--first) = '-';
+            }
+
+            dbf_put_right(dest, width_, first, buf_end - first);
+        }
+    }
+
+private:
+    const double* data_;
+    std::vector<signed char> value_decimals_;
+
+    // The fewest decimals with which `value` can be written exactly (or
+    // -1 if more than DBF_MAX_DECIMALS are needed). If round(value * 10^d)
+    // is exact and dividing it by 10^d gives back `value`, then the
+    // decimal string for round(value * 10^d) / 10^d is read as `value`.
+    static int exact_decimals(double value) {
+        double abs_value = std::fabs(value);
+        for (int d = 0; d <= DBF_MAX_DECIMALS; d++) {
+            double scaled = std::round(abs_value * dbf_pow10[d]);
+            if (scaled >= DBF_MAX_EXACT_INTEGER) {
+                // integers this large are exact with no decimals
+                return (d == 0 && scaled == abs_value && scaled < 1.8446744073709552e19) ? 0 : -1;
+            } else if ((scaled / dbf_pow10[d]) == abs_value) {
+                return d;
+            }
+        }
+
+        return -1;
+    }
+};
+
+// Days since 1970-01-01 are written as YYYYMMDD
+// (http://howardhinnant.github.io/date_algorithms.html#civil_from_days)
+class DatesWriter: public FieldWriter {
+public:
+    DatesWriter(SEXP x): FieldWriter('D'), x_(x) {
+        width_ = 8;
+    }
+
+    void write(R_xlen_t start, R_xlen_t end, char* dest, int record_length) {
+        for (R_xlen_t i = start; i < end; i++, dest += record_length) {
+            double days = (TYPEOF(x_) == INTSXP) ?
+                (INTEGER(x_)[i] == NA_INTEGER ? NA_REAL : INTEGER(x_)[i]) :
+                REAL(x_)[i];
+
+            if (!std::isfinite(days)) {
+                memset(dest, '0', 8);
+                continue;
+            }
+
+            long z = (long) std::floor(days) + 719468;
+            long era = (z >= 0 ? z : z - 146096) / 146097;
+            long doe = z - era * 146097;
+            long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+            long y = yoe + era * 400;
+            long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+            long mp = (5 * doy + 2) / 153;
+            long d = doy - (153 * mp + 2) / 5 + 1;
+            long m = mp < 10 ? mp + 3 : mp - 9;
+            if (m <= 2) {
+                y++;
+            }
+
+            if (y < 0 || y > 9999) {
+                stop("Can't write date with year %ld to a DBF file", y);
+            }
+
+            long yyyymmdd = y * 10000 + m * 100 + d;
+            for (int j = 7; j >= 0; j--) {
+                dest[j] = '0' + (yyyymmdd % 10);
+                yyyymmdd /= 10;
+            }
+        }
+    }
+
+private:
+    SEXP x_;
+};
+
+// Character values are left-aligned and space-padded. Values are translated
+// to UTF-8 once in the pre-pass (R_alloc()ed translations stay valid until
+// the end of the .Call()).
+class StringsWriter: public FieldWriter {
+public:
+    StringsWriter(SEXP x, const std::string& name):
+        FieldWriter('C'), values_(Rf_xlength(x)), sizes_(Rf_xlength(x)) {
+        R_xlen_t size = Rf_xlength(x);
+        for (R_xlen_t i = 0; i < size; i++) {
+            SEXP item = STRING_ELT(x, i);
+            if (item == NA_STRING) {
+                values_[i] = nullptr;
+                sizes_[i] = 0;
+            } else {
+                values_[i] = Rf_translateCharUTF8(item);
+                sizes_[i] = strlen(values_[i]);
+                width_ = std::max(width_, sizes_[i]);
+            }
+        }
+
+        if (width_ > 254) {
+            stop("Can't write values in column '%s' with more than 254 bytes", name.c_str());
+        }
+    }
+
+    void write(R_xlen_t start, R_xlen_t end, char* dest, int record_length) {
+        for (R_xlen_t i = start; i < end; i++, dest += record_length) {
+            memcpy(dest, values_[i], sizes_[i]);
+            memset(dest + sizes_[i], ' ', width_ - sizes_[i]);
+        }
+    }
+
+private:
+    std::vector<const char*> values_;
+    std::vector<int> sizes_;
+};
+
+class FieldWriterFactory {
+public:
+    static std::unique_ptr<FieldWriter> get_writer(SEXP x, const std::string& name) {
+        if (Rf_inherits(x, "Date")) {
+            return std::unique_ptr<FieldWriter>(new DatesWriter(x));
+        }
+
+        switch (TYPEOF(x)) {
+        case LGLSXP: return std::unique_ptr<FieldWriter>(new LogicalsWriter(x));
+        case INTSXP: return std::unique_ptr<FieldWriter>(new IntegersWriter(x));
+        case REALSXP: return std::unique_ptr<FieldWriter>(new DoublesWriter(x, name));
+        case STRSXP: return std::unique_ptr<FieldWriter>(new StringsWriter(x, name));
+        default:
+            stop("Can't write column '%s' of type '%s' to a DBF file", name.c_str(), Rf_type2char(TYPEOF(x)));
+        }
+    }
+};
+
+static void dbf_put_uint16(unsigned char* dest, int value) {
+    dest[0] = value & 0xff;
+    dest[1] = (value >> 8) & 0xff;
+}
+
+[[cpp11::register]]
+void cpp_write_dbf(std::string filename, std::string filename_cpg, list x, strings field_names,
+                   int n_rows) {
+    R_xlen_t row_count = n_rows;
+    int n_fields = x.size();
+    std::vector<std::unique_ptr<FieldWriter>> writers;
+    for (int j = 0; j < n_fields; j++) {
+        SEXP col = x[j];
+        std::string name = field_names[j];
+        if (Rf_xlength(col) != row_count) {
+            stop("Column '%s' must have %d values", name.c_str(), n_rows);
+        }
+
+        writers.push_back(FieldWriterFactory::get_writer(col, name));
+    }
+
+    // Header and field descriptors
+    int header_length = 32 + 32 * n_fields + 1;
+    int record_length = 1;
+    for (auto& writer: writers) {
+        record_length += writer->width();
+    }
+
+    if (header_length > 65535 || record_length > 65535) {
+        stop("Can't write %d fields with a total width of %d to a DBF file", n_fields, record_length - 1);
+    }
+
+    std::vector<unsigned char> header(header_length, 0);
+    time_t now = time(nullptr);
+    struct tm* today = gmtime(&now);
+    header[0] = 0x03;
+    if (today != nullptr) {
+        header[1] = today->tm_year % 256;
+        header[2] = today->tm_mon + 1;
+        header[3] = today->tm_mday;
+    }
+
+    uint32_t n_records = row_count;
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (n_records >> (8 * i)) & 0xff;
+    }
+    dbf_put_uint16(header.data() + 8, header_length);
+    dbf_put_uint16(header.data() + 10, record_length);
+
+    for (int j = 0; j < n_fields; j++) {
+        unsigned char* descriptor = header.data() + 32 + 32 * j;
+        std::string name = field_names[j];
+        memcpy(descriptor, name.c_str(), std::min<size_t>(name.size(), 10));
+        descriptor[11] = writers[j]->type();
+        descriptor[16] = writers[j]->width();
+        descriptor[17] = writers[j]->decimals();
+    }
+    header[header_length - 1] = 0x0D;
+
+    DBFWriteFile dbf(filename);
+    dbf.write(header.data(), header.size());
+
+    // Records
+    R_xlen_t block_rows = std::max(1, SHP_DBF_WRITE_BLOCK_SIZE / record_length);
+    std::vector<char> block(std::min(block_rows, std::max<R_xlen_t>(row_count, 1)) * record_length);
+
+    for (R_xlen_t start = 0; start < row_count; start += block_rows) {
+        check_user_interrupt();
+
+        R_xlen_t end = std::min(start + block_rows, row_count);
+        char* dest = block.data();
+        for (R_xlen_t i = start; i < end; i++) {
+            dest[(i - start) * record_length] = ' ';
+        }
+
+        int field_offset = 1;
+        for (auto& writer: writers) {
+            writer->write(start, end, dest + field_offset, record_length);
+            field_offset += writer->width();
+        }
+
+        dbf.write(dest, (end - start) * record_length);
+    }
+
+    const char eof = 0x1A;
+    dbf.write(&eof, 1);
+    dbf.close();
+
+    DBFWriteFile cpg(filename_cpg);
+    cpg.write("UTF-8", 5);
+    cpg.close();
+}
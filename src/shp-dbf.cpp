@@ -1,9 +1,14 @@
 #include <cpp11.hpp>
 #include <sstream>
 #include <memory>
-#include <clocale>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <climits>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "shapefil.h"
 
 // unclear where inconv_t is defined, but an invalid
@@ -23,9 +28,9 @@ namespace writable = cpp11::writable;
 // 'F' (float), 'I' (integer), 'D' (date) can be in shapfiles found in
 // the wild. All of these values are stored as serialized character
 // sequences that don't need any information about the width or precision
-// to be parsed. The exception is possibly 'L', but I don't have any files
-// that use this type on which to test (according to the dBase spec, this is
-// 0x00 for False and 0x01 for True).
+// to be parsed. The exception is 'L', which is a single character:
+// 'T'/'t'/'Y'/'y' or 'F'/'f'/'N'/'n' ('?' for null) according to the dBase
+// spec, but some files use 0x00 for False and 0x01 for True.
 //
 // This file is contains (1) a small wrapper around DBFOpen() and DBFClose()
 // to manage the lifecycle of the underlying C struct, (2) a set of 
@@ -33,9 +38,16 @@ namespace writable = cpp11::writable;
 // and (3) exported functions used by read_dbf() and read_dbf_meta() in R.
 // The underlying shplib implementation uses atoi and atod to parse
 // strings into doubles/ints. These functions make it difficult to
-// detect parse errors. Here we use C++11's strtod and strtoi with
-// a thread localizer and report parse issues via a readr-style
-// 'problems' object.
+// detect parse errors and depend on the C locale. Here we parse values
+// from views of the raw record (rather than copies made by
+// DBFReadStringAttribute()) using locale-independent parsers
+// and report parse issues via a readr-style 'problems' object.
+//
+// Because records have a fixed width, any row can be read without reading
+// the rows before it. For large files, collectors that don't need the
+// R API (i.e., everything except strings) can be filled by worker threads
+// that each have their own DBF handle and read a range of rows into the
+// pre-allocated output vector.
 
 // Wrapper around R's iconv
 // https://github.com/wch/r-source/blob/trunk/src/main/sysutils.c#L582-L778
@@ -54,20 +66,52 @@ public:
         }
     }
 
-    std::string iconv(const char* bytes) {
-        size_t in_bytes_left = strlen(bytes);
-        ensure_buffer_has_size(in_bytes_left * 2);
-        size_t result = (size_t) -1;
+    // Converts `size` bytes to UTF-8, setting `out` to a buffer that is valid
+    // until the next call. ASCII is the same in every encoding found in
+    // .dbf files, so ASCII bytes are returned as-is without calling iconv.
+    // Returns false if the bytes could not be converted.
+    bool convert(const char* bytes, size_t size, const char** out, size_t* out_size) {
+        if (is_ascii(bytes, size)) {
+            *out = bytes;
+            *out_size = size;
+            return true;
+        }
+
+        // (one byte can become up to 3 bytes of UTF-8, or 4 bytes of UTF-8
+        // for two bytes in a multi-byte encoding)
+        size_t in_bytes_left = size;
+        ensure_buffer_has_size(in_bytes_left * 3 + 1);
         size_t out_bytes_left = buffer_size;
         char* ptr_out = buffer;
-        result = Riconv(iconv_obj, &bytes, &in_bytes_left, &ptr_out, &out_bytes_left);
 
+        // reset the conversion state in case the last conversion failed
+        Riconv(iconv_obj, nullptr, nullptr, nullptr, nullptr);
+        size_t result = Riconv(iconv_obj, &bytes, &in_bytes_left, &ptr_out, &out_bytes_left);
         if ((result == ((size_t) -1)) || (in_bytes_left != 0)) {
-            stop("Conversion to UTF-8 failed");
+            return false;
         }
 
-        std::string output(buffer, buffer_size - out_bytes_left);
-        return output;
+        *out = buffer;
+        *out_size = buffer_size - out_bytes_left;
+        return true;
+    }
+
+    // Checks 8 bytes at a time for a byte with the high bit set (the
+    // compiler can vectorize the OR-reduction of the main loop)
+    static bool is_ascii(const char* bytes, size_t size) {
+        uint64_t high_bits = 0;
+        size_t i = 0;
+        for (; (i + 8) <= size; i += 8) {
+            uint64_t chunk;
+            memcpy(&chunk, bytes + i, sizeof(uint64_t));
+            high_bits |= chunk;
+        }
+
+        for (; i < size; i++) {
+            high_bits |= (unsigned char) bytes[i];
+        }
+
+        return (high_bits & UINT64_C(0x8080808080808080)) == 0;
     }
 
     void ensure_buffer_has_size(size_t size) {
@@ -234,6 +278,16 @@ typedef struct {
     int precision;
 } dbf_field_info_t;
 
+// A view of a field value in the current record. `data` is not
+// null-terminated and is only valid until another record is read.
+// `is_null` is computed along with the view so that collectors don't
+// need to look at the value again to check it.
+typedef struct {
+    const char* data;
+    int size;
+    bool is_null;
+} dbf_span_t;
+
 class DBFFile {
 public:
     DBFFile(std::string filename, std::string encoding = ""): 
@@ -248,6 +302,15 @@ public:
         if (encoding_ == "") {
             encoding_ = DBFEncodings::dbf_encoding(DBFGetCodePage(hDBF));
         }
+
+        // cache the field layout so that values can be sliced from the
+        // raw record without going through DBFReadAttribute()
+        int field_count = DBFGetFieldCount(hDBF);
+        for (int field_index = 0; field_index < field_count; field_index++) {
+            field_offset_.push_back(hDBF->panFieldOffset[field_index]);
+            field_width_.push_back(hDBF->panFieldSize[field_index]);
+            field_type_.push_back(hDBF->pachFieldType[field_index]);
+        }
     }
 
     ~DBFFile() {
@@ -279,190 +342,960 @@ public:
         return this->encoding_;
     }
 
-    bool value_is_null(int row_index, int field_index) {
-        return DBFIsAttributeNULL(hDBF, row_index, field_index);
+    // Returns a view of the value with leading and trailing spaces removed
+    // (like DBFReadStringAttribute()) without copying it out of the record,
+    // and whether it is null according to the same rules as
+    // DBFIsAttributeNULL(). Trailing padding is removed first so that
+    // each byte of a mostly empty (space-padded) field is only read once.
+    // If the record can't be read (or is -1), the span has a data pointer
+    // of nullptr and is null.
+    dbf_span_t value(int row_index, int field_index) {
+        dbf_span_t span;
+        const char* record = DBFReadTupleView(hDBF, row_index);
+        if (record == nullptr) {
+            span.data = nullptr;
+            span.size = 0;
+            span.is_null = true;
+            return span;
+        }
+
+        const char* start = record + field_offset_[field_index];
+        const char* end = start + field_width_[field_index];
+        while (end > start && *(end - 1) == ' ') {
+            end--;
+        }
+
+        while (start < end && *start == ' ') {
+            start++;
+        }
+
+        // values are null-terminated if they contain a null character
+        const char* nul = (const char*) memchr(start, '\0', end - start);
+        if (nul != nullptr) {
+            end = nul;
+            while (end > start && *(end - 1) == ' ') {
+                end--;
+            }
+        }
+
+        span.data = start;
+        span.size = end - start;
+
+        switch (field_type_[field_index]) {
+        case 'N':
+        case 'F':
+            span.is_null = (span.size == 0) || (*start == '*');
+            break;
+        case 'D':
+            span.is_null = (span.size >= 8) && (memcmp(start, "00000000", 8) == 0);
+            break;
+        case 'L':
+            span.is_null = (span.size > 0) && (*start == '?');
+            break;
+        default:
+            span.is_null = span.size == 0;
+            break;
+        }
+
+        return span;
     }
 
-    const char* value_string(int row_index, int field_index) {
-        return DBFReadStringAttribute(hDBF, row_index, field_index);
+    // Read records in blocks of (up to) `block_size` bytes rather than
+    // one seek + read per record. Use 0 to disable.
+    void set_read_block_size(int block_size) {
+        DBFSetReadBlockSize(hDBF, block_size);
     }
 
 private:
     std::string filename_;
     std::string encoding_;
     DBFHandle hDBF;
+    std::vector<int> field_offset_;
+    std::vector<int> field_width_;
+    std::vector<char> field_type_;
 };
 
+// Problems are accumulated in C++ containers rather than R vectors so that
+// worker threads can collect them without calling the R API.
 class Problems {
 public:
-    void add_problem(int row, int col, const char* expected, const char* actual) {
+    void add_problem(int row, int col, const char* expected, const std::string& actual) {
         this->row.push_back(row);
         this->col.push_back(col);
         this->expected.push_back(expected);
         this->actual.push_back(actual);
     }
 
+    // Add problems from another Problems object, keeping them in row-major
+    // order as if they had been collected by a single thread.
+    void merge(const Problems& other) {
+        if (other.row.size() == 0) {
+            return;
+        }
+
+        std::vector<size_t> order(row.size() + other.row.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+
+        size_t n = row.size();
+        std::vector<int> all_row(row);
+        std::vector<int> all_col(col);
+        all_row.insert(all_row.end(), other.row.begin(), other.row.end());
+        all_col.insert(all_col.end(), other.col.begin(), other.col.end());
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return (all_row[a] < all_row[b]) || 
+                ((all_row[a] == all_row[b]) && (all_col[a] < all_col[b]));
+        });
+
+        std::vector<std::string> all_expected, all_actual;
+        all_expected.reserve(order.size());
+        all_actual.reserve(order.size());
+        row.clear();
+        col.clear();
+        for (size_t i: order) {
+            row.push_back(all_row[i]);
+            col.push_back(all_col[i]);
+            all_expected.push_back(i < n ? expected[i] : other.expected[i - n]);
+            all_actual.push_back(i < n ? actual[i] : other.actual[i - n]);
+        }
+
+        expected = std::move(all_expected);
+        actual = std::move(all_actual);
+    }
+
     list result() {
-        writable::list result = {row, col, expected, actual};
+        writable::integers row_sexp(row.size());
+        writable::integers col_sexp(col.size());
+        writable::strings expected_sexp(expected.size());
+        writable::strings actual_sexp(actual.size());
+        for (size_t i = 0; i < row.size(); i++) {
+            row_sexp[i] = row[i];
+            col_sexp[i] = col[i];
+            expected_sexp[i] = expected[i];
+            actual_sexp[i] = actual[i];
+        }
+
+        writable::list result = {row_sexp, col_sexp, expected_sexp, actual_sexp};
         result.names() = {"row", "col", "expected", "actual"};
         return result;
     }
 
 private:
-    writable::integers row;
-    writable::integers col;
-    writable::strings expected;
-    writable::strings actual;
+    std::vector<int> row;
+    std::vector<int> col;
+    std::vector<std::string> expected;
+    std::vector<std::string> actual;
 };
 
-class ThreadLocalizer {
-public:
-    ThreadLocalizer() {
-        char* p = std::setlocale(LC_NUMERIC, nullptr);
-        if(p != nullptr) {
-        this->saved_locale = p;
+// Numeric values in DBF files are right-aligned ASCII with a '.' decimal
+// separator, padded with spaces. Values that don't fit in the field are
+// written as '*' characters and missing values as blanks. strtod() and strtol()
+// depend on the (process-global) C locale and require a null-terminated
+// string, so these parsers work on a value span directly. Doubles that
+// can be represented exactly as an integer mantissa times an exact power of ten
+// (i.e., most values in DBF files) are computed directly (Clinger's fast path);
+// anything else falls back to a correctly rounded big-decimal conversion
+// (see dbf_decimal_to_double()). Neither uses the C library or the locale,
+// so both are safe to call from worker threads.
+enum dbf_parse_status_t {
+    DBF_PARSE_OK,
+    DBF_PARSE_NA,
+    DBF_PARSE_INVALID,
+    DBF_PARSE_OUT_OF_RANGE
+};
+
+static inline bool dbf_is_digit(char c) {
+    return (c >= '0') && (c <= '9');
+}
+
+// Values that don't fit in a numeric field are written as all '*'
+static inline bool dbf_span_is_overflow(const char* data, const char* end) {
+    if (data == end) {
+        return false;
+    }
+
+    for (; data < end; data++) {
+        if (*data != '*') {
+            return false;
         }
-        std::setlocale(LC_NUMERIC, "C");
     }
 
-    ~ThreadLocalizer() {
-        std::setlocale(LC_NUMERIC, saved_locale.c_str());
+    return true;
+}
+
+static inline bool dbf_span_equal_nocase(const char* data, const char* end, const char* lower) {
+    for (; *lower != '\0'; data++, lower++) {
+        if ((data >= end) || ((*data | 0x20) != *lower)) {
+            return false;
+        }
     }
-private:
-    std::string saved_locale;
+
+    return data == end;
+}
+
+static dbf_parse_status_t dbf_parse_int(const dbf_span_t& value, int* result) {
+    const char* chars = value.data;
+    const char* end = value.data + value.size;
+    if ((chars == end) || dbf_span_is_overflow(chars, end)) {
+        return DBF_PARSE_NA;
+    }
+
+    bool negative = false;
+    if ((*chars == '-') || (*chars == '+')) {
+        negative = *chars == '-';
+        chars++;
+    }
+
+    // Accumulate as a negative number so that INT_MIN doesn't overflow;
+    // anything with more digits than fit in 64 bits is out of range anyway
+    const char* digits_start = chars;
+    int64_t accumulator = 0;
+    bool out_of_range = false;
+    for (; (chars < end) && dbf_is_digit(*chars); chars++) {
+        if (accumulator < -((int64_t) INT_MAX + 1)) {
+            out_of_range = true;
+        } else {
+            accumulator = accumulator * 10 - (*chars - '0');
+        }
+    }
+
+    if ((chars == digits_start) || (chars != end)) {
+        return DBF_PARSE_INVALID;
+    }
+
+    if (!negative) {
+        accumulator = -accumulator;
+    }
+
+    // INT_MIN is NA_INTEGER in R
+    if (out_of_range || (accumulator > INT_MAX) || (accumulator <= INT_MIN)) {
+        return DBF_PARSE_OUT_OF_RANGE;
+    }
+
+    *result = accumulator;
+    return DBF_PARSE_OK;
+}
+
+// The slow path for values that the fast path can't compute exactly:
+// the value is kept as a decimal (digits with a decimal point position)
+// and shifted by powers of two until it is in [1, 2) with the number of
+// fraction digits needed to round it to a double (the "simple decimal
+// conversion" algorithm used by Go's strconv and fast_float). This is
+// correctly rounded (ties to even) for any input but much slower than
+// the fast path, which is fine because DBF files rarely need it.
+#define DBF_DECIMAL_MAX_DIGITS 800
+#define DBF_DECIMAL_MAX_SHIFT 60
+
+struct dbf_decimal_t {
+    uint8_t digits[DBF_DECIMAL_MAX_DIGITS];
+    int n_digits;
+    // the position of the decimal point relative to the first digit
+    int decimal_point;
+    // true if non-zero digits were dropped after the last digit
+    bool truncated;
 };
 
+static void dbf_decimal_trim(dbf_decimal_t* d) {
+    while ((d->n_digits > 0) && (d->digits[d->n_digits - 1] == 0)) {
+        d->n_digits--;
+    }
+
+    if (d->n_digits == 0) {
+        d->decimal_point = 0;
+    }
+}
+
+// Expects a value that dbf_parse_double() has already validated
+static void dbf_decimal_parse(dbf_decimal_t* d, const char* chars, const char* end) {
+    d->n_digits = 0;
+    d->decimal_point = 0;
+    d->truncated = false;
+
+    bool saw_dot = false;
+    for (; (chars < end) && (dbf_is_digit(*chars) || (*chars == '.')); chars++) {
+        if (*chars == '.') {
+            saw_dot = true;
+            d->decimal_point = d->n_digits;
+        } else if ((*chars == '0') && (d->n_digits == 0)) {
+            // leading zeros only move the decimal point
+            d->decimal_point--;
+        } else if (d->n_digits < DBF_DECIMAL_MAX_DIGITS) {
+            d->digits[d->n_digits++] = *chars - '0';
+        } else if (*chars != '0') {
+            d->truncated = true;
+        }
+    }
+
+    if (!saw_dot) {
+        d->decimal_point = d->n_digits;
+    }
+
+    if ((chars < end) && ((*chars == 'e') || (*chars == 'E'))) {
+        chars++;
+        bool exponent_negative = false;
+        if ((*chars == '-') || (*chars == '+')) {
+            exponent_negative = *chars == '-';
+            chars++;
+        }
+
+        int exponent = 0;
+        for (; chars < end; chars++) {
+            if (exponent < 100000) {
+                exponent = exponent * 10 + (*chars - '0');
+            }
+        }
+
+        d->decimal_point += exponent_negative ? -exponent : exponent;
+    }
+
+    dbf_decimal_trim(d);
+}
+
+// Multiplies by 2^shift (shift <= DBF_DECIMAL_MAX_SHIFT)
+static void dbf_decimal_left_shift(dbf_decimal_t* d, int shift) {
+    // 2^60 adds at most 19 digits
+    uint8_t shifted[DBF_DECIMAL_MAX_DIGITS + 20];
+    int write_index = DBF_DECIMAL_MAX_DIGITS + 19;
+    uint64_t n = 0;
+    for (int read_index = d->n_digits - 1; read_index >= 0; read_index--) {
+        n += ((uint64_t) d->digits[read_index]) << shift;
+        uint64_t quotient = n / 10;
+        shifted[write_index--] = n - 10 * quotient;
+        n = quotient;
+    }
+
+    while (n > 0) {
+        uint64_t quotient = n / 10;
+        shifted[write_index--] = n - 10 * quotient;
+        n = quotient;
+    }
+
+    int n_shifted = DBF_DECIMAL_MAX_DIGITS + 19 - write_index;
+    d->decimal_point += n_shifted - d->n_digits;
+    d->n_digits = std::min(n_shifted, DBF_DECIMAL_MAX_DIGITS);
+    for (int i = d->n_digits; i < n_shifted; i++) {
+        if (shifted[write_index + 1 + i] != 0) {
+            d->truncated = true;
+        }
+    }
+
+    memcpy(d->digits, shifted + write_index + 1, d->n_digits);
+    dbf_decimal_trim(d);
+}
+
+// Divides by 2^shift (shift <= DBF_DECIMAL_MAX_SHIFT)
+static void dbf_decimal_right_shift(dbf_decimal_t* d, int shift) {
+    int read_index = 0;
+    int write_index = 0;
+    uint64_t n = 0;
+
+    // skip digits until the result is non-zero
+    for (; (n >> shift) == 0; read_index++) {
+        if (read_index >= d->n_digits) {
+            if (n == 0) {
+                d->n_digits = 0;
+                d->decimal_point = 0;
+                return;
+            }
+
+            while ((n >> shift) == 0) {
+                n = n * 10;
+                read_index++;
+            }
+
+            break;
+        }
+
+        n = n * 10 + d->digits[read_index];
+    }
+
+    d->decimal_point -= read_index - 1;
+
+    uint64_t mask = (((uint64_t) 1) << shift) - 1;
+    for (; read_index < d->n_digits; read_index++) {
+        uint8_t digit = d->digits[read_index];
+        d->digits[write_index++] = n >> shift;
+        n = ((n & mask) * 10) + digit;
+    }
+
+    while (n > 0) {
+        uint8_t digit = n >> shift;
+        n = (n & mask) * 10;
+        if (write_index < DBF_DECIMAL_MAX_DIGITS) {
+            d->digits[write_index++] = digit;
+        } else if (digit > 0) {
+            d->truncated = true;
+        }
+    }
+
+    d->n_digits = write_index;
+    dbf_decimal_trim(d);
+}
+
+static void dbf_decimal_shift(dbf_decimal_t* d, int shift) {
+    if (d->n_digits == 0) {
+        return;
+    }
+
+    for (; shift > DBF_DECIMAL_MAX_SHIFT; shift -= DBF_DECIMAL_MAX_SHIFT) {
+        dbf_decimal_left_shift(d, DBF_DECIMAL_MAX_SHIFT);
+    }
+
+    for (; shift < -DBF_DECIMAL_MAX_SHIFT; shift += DBF_DECIMAL_MAX_SHIFT) {
+        dbf_decimal_right_shift(d, DBF_DECIMAL_MAX_SHIFT);
+    }
+
+    if (shift > 0) {
+        dbf_decimal_left_shift(d, shift);
+    } else if (shift < 0) {
+        dbf_decimal_right_shift(d, -shift);
+    }
+}
+
+// The integer part of the decimal, rounded half to even (the decimal must
+// be less than 2^64)
+static uint64_t dbf_decimal_rounded_integer(const dbf_decimal_t* d) {
+    uint64_t n = 0;
+    int i = 0;
+    for (; (i < d->decimal_point) && (i < d->n_digits); i++) {
+        n = n * 10 + d->digits[i];
+    }
+
+    for (; i < d->decimal_point; i++) {
+        n = n * 10;
+    }
+
+    int dp = d->decimal_point;
+    if ((dp >= 0) && (dp < d->n_digits)) {
+        bool round_up;
+        if ((d->digits[dp] == 5) && ((dp + 1) == d->n_digits)) {
+            round_up = d->truncated || ((dp > 0) && (d->digits[dp - 1] % 2 != 0));
+        } else {
+            round_up = d->digits[dp] >= 5;
+        }
+
+        n += round_up;
+    }
+
+    return n;
+}
+
+static double dbf_decimal_to_double(dbf_decimal_t* d) {
+    // the number of binary digits needed to shift by ~10^decimal_point
+    static const int powers[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+    static const int n_powers = sizeof(powers) / sizeof(int);
+    const int mantissa_bits = 52;
+    const int exponent_bias = -1023;
+
+    if ((d->n_digits == 0) || (d->decimal_point < -330)) {
+        return 0;
+    } else if (d->decimal_point > 310) {
+        return R_PosInf;
+    }
+
+    // scale to [0.5, 1)
+    int exponent = 0;
+    while (d->decimal_point > 0) {
+        int shift = d->decimal_point >= n_powers ? 27 : powers[d->decimal_point];
+        dbf_decimal_shift(d, -shift);
+        exponent += shift;
+    }
+
+    while ((d->decimal_point < 0) || ((d->decimal_point == 0) && (d->digits[0] < 5))) {
+        int shift = -d->decimal_point >= n_powers ? 27 : powers[-d->decimal_point];
+        dbf_decimal_shift(d, shift);
+        exponent -= shift;
+    }
+
+    // [1, 2), or denormal if the exponent is too small
+    exponent--;
+    if (exponent < (exponent_bias + 1)) {
+        int shift = exponent_bias + 1 - exponent;
+        dbf_decimal_shift(d, -shift);
+        exponent += shift;
+    }
+
+    if ((exponent - exponent_bias) >= 0x7ff) {
+        return R_PosInf;
+    }
+
+    dbf_decimal_shift(d, 1 + mantissa_bits);
+    uint64_t mantissa = dbf_decimal_rounded_integer(d);
+
+    // rounding up may carry into another bit
+    if (mantissa == (((uint64_t) 2) << mantissa_bits)) {
+        mantissa >>= 1;
+        exponent++;
+        if ((exponent - exponent_bias) >= 0x7ff) {
+            return R_PosInf;
+        }
+    }
+
+    if ((mantissa & (((uint64_t) 1) << mantissa_bits)) == 0) {
+        exponent = exponent_bias;
+    }
+
+    uint64_t bits = (mantissa & ((((uint64_t) 1) << mantissa_bits) - 1)) |
+        (((uint64_t) (exponent - exponent_bias) & 0x7ff) << mantissa_bits);
+    double result;
+    memcpy(&result, &bits, sizeof(double));
+    return result;
+}
+
+static dbf_parse_status_t dbf_parse_double_fallback(const char* chars, const char* end, bool negative,
+                                                    double* result) {
+    dbf_decimal_t decimal;
+    dbf_decimal_parse(&decimal, chars, end);
+    double dbl_value = dbf_decimal_to_double(&decimal);
+    *result = negative ? -dbl_value : dbl_value;
+    return DBF_PARSE_OK;
+}
+
+static dbf_parse_status_t dbf_parse_double(const dbf_span_t& value, double* result) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* chars = value.data;
+    const char* end = value.data + value.size;
+    if ((chars == end) || dbf_span_is_overflow(chars, end)) {
+        return DBF_PARSE_NA;
+    }
+
+    bool negative = false;
+    if ((*chars == '-') || (*chars == '+')) {
+        negative = *chars == '-';
+        chars++;
+    }
+
+    if (dbf_span_equal_nocase(chars, end, "nan")) {
+        *result = R_NaN;
+        return DBF_PARSE_OK;
+    } else if (dbf_span_equal_nocase(chars, end, "inf") || 
+               dbf_span_equal_nocase(chars, end, "infinity")) {
+        *result = negative ? R_NegInf : R_PosInf;
+        return DBF_PARSE_OK;
+    }
+
+    // Collect up to 19 significant digits (which always fit in a uint64_t)
+    const char* digits_start = chars;
+    uint64_t mantissa = 0;
+    int n_significant = 0;
+    int n_digits = 0;
+    int exponent = 0;
+    for (; (chars < end) && dbf_is_digit(*chars); chars++, n_digits++) {
+        if (n_significant < 19) {
+            mantissa = mantissa * 10 + (*chars - '0');
+            n_significant += mantissa > 0;
+        } else {
+            exponent++;
+            n_significant++;
+        }
+    }
+
+    if ((chars < end) && (*chars == '.')) {
+        chars++;
+        for (; (chars < end) && dbf_is_digit(*chars); chars++, n_digits++) {
+            if (n_significant < 19) {
+                mantissa = mantissa * 10 + (*chars - '0');
+                n_significant += mantissa > 0;
+                exponent--;
+            } else {
+                n_significant++;
+            }
+        }
+    }
+
+    if (n_digits == 0) {
+        return DBF_PARSE_INVALID;
+    }
+
+    if ((chars < end) && ((*chars == 'e') || (*chars == 'E'))) {
+        chars++;
+        bool exponent_negative = false;
+        if ((chars < end) && ((*chars == '-') || (*chars == '+'))) {
+            exponent_negative = *chars == '-';
+            chars++;
+        }
+
+        const char* exponent_start = chars;
+        int explicit_exponent = 0;
+        for (; (chars < end) && dbf_is_digit(*chars); chars++) {
+            if (explicit_exponent < 100000) {
+                explicit_exponent = explicit_exponent * 10 + (*chars - '0');
+            }
+        }
+
+        if (chars == exponent_start) {
+            return DBF_PARSE_INVALID;
+        }
+
+        exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+    }
+
+    if (chars != end) {
+        return DBF_PARSE_INVALID;
+    }
+
+    if ((n_significant <= 19) && (mantissa <= (((uint64_t) 1) << 53)) && 
+            (exponent >= -22) && (exponent <= 22)) {
+        double dbl_value = mantissa;
+        if (exponent < 0) {
+            dbl_value /= powers_of_ten[-exponent];
+        } else {
+            dbl_value *= powers_of_ten[exponent];
+        }
+
+        *result = negative ? -dbl_value : dbl_value;
+        return DBF_PARSE_OK;
+    }
+
+    return dbf_parse_double_fallback(digits_start, end, negative, result);
+}
+
+// Collectors write the value of record `record_index` (or NA if this is -1)
+// to `row_index` of their output vector.
+// A collector is thread safe if put() can be called concurrently for
+// different rows from worker threads (i.e., it doesn't touch the R API).
+// The base class is used for skipped columns, whose values are never read.
 class Collector {
 public:
     virtual ~Collector() {}
     virtual sexp result() { return R_NilValue; }
-    virtual void put(DBFFile& dbf, Problems& problems, int row_index, int field_index) {}
+    virtual bool is_skipped() { return true; }
+    virtual bool is_thread_safe() { return true; }
+    virtual void put(DBFFile& dbf, Problems& problems, int record_index, int row_index, int field_index) {}
 };
 
 template <class vector_t>
 class VectorCollector: public Collector {
 public:
-    VectorCollector(int size): result_(size), i(0) {}
+    VectorCollector(int size): result_(size) {}
     sexp result() { return result_; }
+    bool is_skipped() { return false; }
 protected:
     vector_t result_;
-    int i;
+};
+
+// Character fields often have a small number of distinct values (e.g., codes
+// or categories). StringLevels converts each distinct value to a CHARSXP once
+// and looks up repeated values by their raw bytes, which avoids the
+// iconv call and the CHARSXP cache lookup for every row. Keys are
+// stored in one buffer and the hash table holds level indices, so a
+// lookup doesn't allocate. For mostly-unique columns (e.g., names or IDs)
+// the lookup only adds overhead, so StringsCollector stops using the
+// cache if more than half of the first DBF_CACHED_STRINGS_SAMPLE values
+// were distinct.
+#ifndef DBF_MAX_CACHED_STRINGS
+#define DBF_MAX_CACHED_STRINGS 65536
+#endif
+
+#ifndef DBF_CACHED_STRINGS_SAMPLE
+#define DBF_CACHED_STRINGS_SAMPLE 1024
+#endif
+
+class StringLevels {
+public:
+    StringLevels(const std::string& encoding, int max_levels):
+        iconv_(encoding.c_str()), encoding_(encoding), max_levels_(max_levels),
+        slots_(64, -1), levels_(Rf_allocVector(STRSXP, 64)), n_levels_(0) {}
+
+    // Returns the level of `value`, adding it as a new level if it hasn't
+    // been seen before. Returns -1 if `value` is new and there are already
+    // max_levels levels.
+    int level(const dbf_span_t& value, Problems& problems, int row_index, int field_index) {
+        uint64_t hash = hash_bytes(value.data, value.size);
+        size_t mask = slots_.size() - 1;
+        size_t slot = hash & mask;
+        while (slots_[slot] != -1) {
+            int level = slots_[slot];
+            if ((hashes_[level] == hash) && (key_size_[level] == value.size) &&
+                    ((value.size == 0) || (memcmp(keys_.data() + key_offset_[level], value.data, value.size) == 0))) {
+                // keep the problem for every row with a value that can't be converted
+                if (!level_ok_[level]) {
+                    add_problem(value, problems, row_index, field_index);
+                }
+
+                return level;
+            }
+
+            slot = (slot + 1) & mask;
+        }
+
+        if (n_levels_ >= max_levels_) {
+            return -1;
+        }
+
+        if (n_levels_ == Rf_xlength(levels_)) {
+            levels_ = Rf_xlengthgets(levels_, n_levels_ * 2);
+        }
+
+        bool ok;
+        SET_STRING_ELT(levels_, n_levels_, convert(value, problems, row_index, field_index, &ok));
+
+        slots_[slot] = n_levels_;
+        hashes_.push_back(hash);
+        key_offset_.push_back(keys_.size());
+        key_size_.push_back(value.size);
+        keys_.insert(keys_.end(), value.data, value.data + value.size);
+        level_ok_.push_back(ok);
+        n_levels_++;
+
+        // keep the table at most half full
+        if ((n_levels_ * 2) > (int) slots_.size()) {
+            rehash(slots_.size() * 2);
+        }
+
+        return n_levels_ - 1;
+    }
+
+    SEXP level_char(int level) {
+        return STRING_ELT(levels_, level);
+    }
+
+    int n_levels() {
+        return n_levels_;
+    }
+
+    // Converts `value` to a CHARSXP without adding it as a level. Values
+    // that can't be converted are kept as-is and added to `problems`.
+    SEXP convert(const dbf_span_t& value, Problems& problems, int row_index, int field_index, bool* ok) {
+        const char* utf8;
+        size_t utf8_size;
+        *ok = iconv_.convert(value.data, value.size, &utf8, &utf8_size);
+        if (*ok) {
+            return Rf_mkCharLenCE(utf8, utf8_size, CE_UTF8);
+        } else {
+            add_problem(value, problems, row_index, field_index);
+            return Rf_mkCharLenCE(value.data, value.size, CE_UTF8);
+        }
+    }
+
+    sexp levels() {
+        return Rf_xlengthgets(levels_, n_levels_);
+    }
+
+private:
+    IconvUTF8 iconv_;
+    std::string encoding_;
+    int max_levels_;
+    std::vector<int> slots_;
+    std::vector<uint64_t> hashes_;
+    std::vector<size_t> key_offset_;
+    std::vector<int> key_size_;
+    std::vector<char> keys_;
+    std::vector<bool> level_ok_;
+    sexp levels_;
+    int n_levels_;
+
+    // FNV-1a
+    static uint64_t hash_bytes(const char* data, size_t size) {
+        uint64_t hash = UINT64_C(14695981039346656037);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= (unsigned char) data[i];
+            hash *= UINT64_C(1099511628211);
+        }
+
+        return hash;
+    }
+
+    void rehash(size_t n_slots) {
+        slots_.assign(n_slots, -1);
+        size_t mask = n_slots - 1;
+        for (int level = 0; level < n_levels_; level++) {
+            size_t slot = hashes_[level] & mask;
+            while (slots_[slot] != -1) {
+                slot = (slot + 1) & mask;
+            }
+
+            slots_[slot] = level;
+        }
+    }
+
+    void add_problem(const dbf_span_t& value, Problems& problems, int row_index, int field_index) {
+        std::stringstream expected;
+        expected << "A string with encoding '" << encoding_ << "'";
+        problems.add_problem(
+            row_index, field_index, 
+            expected.str().c_str(),
+            std::string(value.data, value.size)
+        );
+    }
 };
 
 class StringsCollector: public VectorCollector<writable::strings> {
 public:
     StringsCollector(int size, const std::string& encoding): 
         VectorCollector<writable::strings>(size), 
-        iconv(encoding.c_str()), 
-        encoding(encoding) {}
+        levels(encoding, DBF_MAX_CACHED_STRINGS), use_cache(true), n_seen(0) {}
+
+    bool is_thread_safe() { return false; }
     
-    void put(DBFFile& dbf, Problems& problems, int row_index, int field_index) {
-        if (dbf.value_is_null(row_index, field_index)) {
-            result_[i++] = NA_STRING;
+    void put(DBFFile& dbf, Problems& problems, int record_index, int row_index, int field_index) {
+        dbf_span_t value = dbf.value(record_index, field_index);
+        if (value.is_null) {
+            result_[row_index] = NA_STRING;
+            return;
+        }
+
+        if (use_cache && (++n_seen == DBF_CACHED_STRINGS_SAMPLE)) {
+            use_cache = (levels.n_levels() * 2) <= n_seen;
+        }
+
+        // Once the cache is full (or not used), values that aren't
+        // already cached are converted directly
+        int level = use_cache ? levels.level(value, problems, row_index, field_index) : -1;
+        if (level == -1) {
+            bool ok;
+            SET_STRING_ELT(result_, row_index, levels.convert(value, problems, row_index, field_index, &ok));
         } else {
-            const char* bytes = dbf.value_string(row_index, field_index);
-            try {
-                result_[i++] = iconv.iconv(bytes);
-            } catch(std::exception& error) {
-                result_[i++] = bytes;
-
-                std::stringstream expected;
-                expected << "A string with encoding '" << encoding << "'";
-                problems.add_problem(
-                    row_index, field_index, 
-                    expected.str().c_str(),
-                    bytes
-                );
-            }
+            SET_STRING_ELT(result_, row_index, levels.level_char(level));
         }
     }
 
 private:
-    IconvUTF8 iconv;
-    const std::string& encoding;
+    StringLevels levels;
+    bool use_cache;
+    int n_seen;
 };
 
-class IntegersCollector: public VectorCollector<writable::integers> {
+// Reads character fields as a factor whose levels are in the order they
+// were first read (like readr::col_factor())
+class FactorCollector: public VectorCollector<writable::integers> {
 public:
-    IntegersCollector(int size): VectorCollector<writable::integers>(size) {}
-    void put(DBFFile& dbf, Problems& problems, int row_index, int field_index) {
-        if (dbf.value_is_null(row_index, field_index)) {
-            result_[i++] = NA_INTEGER;
+    FactorCollector(int size, const std::string& encoding): 
+        VectorCollector<writable::integers>(size), 
+        data_(INTEGER(result_)),
+        levels(encoding, INT_MAX) {}
+
+    bool is_thread_safe() { return false; }
+
+    void put(DBFFile& dbf, Problems& problems, int record_index, int row_index, int field_index) {
+        dbf_span_t value = dbf.value(record_index, field_index);
+        if (value.is_null) {
+            data_[row_index] = NA_INTEGER;
         } else {
-            const char* chars = dbf.value_string(row_index, field_index);
-            char* end_char;
-            long int value = std::strtol(chars, &end_char, 10);
-
-            if (end_char != (chars + strlen(chars))) {
-                problems.add_problem(row_index, field_index, "no trailing characters", chars);
-                result_[i++] = NA_INTEGER;
-            } else if ((value > INT_MAX) || (value < NA_INTEGER)) {
-                problems.add_problem(row_index, field_index, "an integer in the 32-bit signed range", chars);
-                result_[i++] = NA_INTEGER;
-            } else {
-                result_[i++] = value;
-            }
+            data_[row_index] = levels.level(value, problems, row_index, field_index) + 1;
         }
     }
+
+    sexp result() {
+        result_.attr("levels") = levels.levels();
+        result_.attr("class") = "factor";
+        return result_;
+    }
+
+private:
+    int* data_;
+    StringLevels levels;
+};
+
+class IntegersCollector: public VectorCollector<writable::integers> {
+public:
+    IntegersCollector(int size): VectorCollector<writable::integers>(size), data_(INTEGER(result_)) {}
+    void put(DBFFile& dbf, Problems& problems, int record_index, int row_index, int field_index) {
+        dbf_span_t value = dbf.value(record_index, field_index);
+        if (value.is_null) {
+            data_[row_index] = NA_INTEGER;
+            return;
+        }
+
+        int int_value;
+        switch (dbf_parse_int(value, &int_value)) {
+        case DBF_PARSE_OK:
+            data_[row_index] = int_value;
+            break;
+        case DBF_PARSE_NA:
+            data_[row_index] = NA_INTEGER;
+            break;
+        case DBF_PARSE_OUT_OF_RANGE:
+            problems.add_problem(row_index, field_index, "an integer in the 32-bit signed range", std::string(value.data, value.size));
+            data_[row_index] = NA_INTEGER;
+            break;
+        default:
+            problems.add_problem(row_index, field_index, "no trailing characters", std::string(value.data, value.size));
+            data_[row_index] = NA_INTEGER;
+            break;
+        }
+    }
+
+private:
+    int* data_;
 };
 
 class DoublesCollector: public VectorCollector<writable::doubles> {
 public:
-    DoublesCollector(int size): VectorCollector<writable::doubles>(size) {}
-    void put(DBFFile& dbf, Problems& problems, int row_index, int field_index) {
-        if (dbf.value_is_null(row_index, field_index)) {
-            result_[i++] = NA_REAL;
-        } else {
-            const char* chars = dbf.value_string(row_index, field_index);
-            char* end_char;
-            double value = std::strtod(chars, &end_char);
+    DoublesCollector(int size): VectorCollector<writable::doubles>(size), data_(REAL(result_)) {}
+    void put(DBFFile& dbf, Problems& problems, int record_index, int row_index, int field_index) {
+        dbf_span_t value = dbf.value(record_index, field_index);
+        if (value.is_null) {
+            data_[row_index] = NA_REAL;
+            return;
+        }
 
-            if (end_char != (chars + strlen(chars))) {
-                problems.add_problem(row_index, field_index, "no trailing characters", chars);
-                result_[i++] = NA_REAL;
-            } else {
-                result_[i++] = value;
-            }
+        double dbl_value;
+        switch (dbf_parse_double(value, &dbl_value)) {
+        case DBF_PARSE_OK:
+            data_[row_index] = dbl_value;
+            break;
+        case DBF_PARSE_NA:
+            data_[row_index] = NA_REAL;
+            break;
+        default:
+            problems.add_problem(row_index, field_index, "no trailing characters", std::string(value.data, value.size));
+            data_[row_index] = NA_REAL;
+            break;
         }
     }
+
+private:
+    double* data_;
 };
 
 class LogicalsCollector: public VectorCollector<writable::logicals> {
 public:
     LogicalsCollector(int size, char dbf_type): 
-        VectorCollector<writable::logicals>(size), dbf_type(dbf_type) {}
+        VectorCollector<writable::logicals>(size), data_(LOGICAL(result_)), dbf_type(dbf_type) {}
     
-    void put(DBFFile& dbf, Problems& problems, int row_index, int field_index) {
-        if (dbf.value_is_null(row_index, field_index)) {
-            result_[i++] = NA_LOGICAL;
+    void put(DBFFile& dbf, Problems& problems, int record_index, int row_index, int field_index) {
+        dbf_span_t value = dbf.value(record_index, field_index);
+        if (value.is_null) {
+            data_[row_index] = NA_LOGICAL;
         } else if (dbf_type == 'L') {
-            const char* chars = dbf.value_string(row_index, field_index);
-            if (strlen(chars) > 1) {
-                result_[i++] = NA_LOGICAL;
-            } else if (chars[0] > 1) {
+            char chars = value.size > 0 ? value.data[0] : '\0';
+            if (value.size > 1) {
+                data_[row_index] = NA_LOGICAL;
+            } else if (chars == 'T' || chars == 't' || chars == 'Y' || chars == 'y') {
+                data_[row_index] = 1;
+            } else if (chars == 'F' || chars == 'f' || chars == 'N' || chars == 'n') {
+                data_[row_index] = 0;
+            } else if (chars > 1) {
                 char hex_buf[5];
-                sprintf(hex_buf, "%#02x", chars[0]);
-                problems.add_problem(row_index, field_index, "0x00 or 0x01", hex_buf);
-                result_[i++] = NA_LOGICAL;
+                sprintf(hex_buf, "%#02x", chars);
+                problems.add_problem(row_index, field_index, "T/t/Y/y/F/f/N/n/?, 0x00, or 0x01", hex_buf);
+                data_[row_index] = NA_LOGICAL;
             } else {
-                result_[i++] = chars[0];
+                data_[row_index] = chars;
             }
         } else {
-            std::string chars = dbf.value_string(row_index, field_index);
+            std::string chars(value.data, value.size);
             if (chars == "true" || chars == "TRUE" || 
                 chars == "T" || chars == "t" || chars == "1") {
-                result_[i++] = 1;
+                data_[row_index] = 1;
             } else if (chars == "false" || chars == "FALSE" || 
                 chars == "F" || chars == "f" || chars == "0") {
-                result_[i++] = 0;
+                data_[row_index] = 0;
             } else {
                 problems.add_problem(row_index, field_index, "true/TRUE/t/1/false/FALSE/f/0", chars.c_str());
-                result_[i++] = NA_LOGICAL;
+                data_[row_index] = NA_LOGICAL;
             }
         }
     }
 
 private:
+    int* data_;
     char dbf_type;
 };
 
@@ -497,6 +1330,7 @@ public:
         case '?': return get_collector_auto(dbf_type, row_count);
         case '-': return std::unique_ptr<Collector>(new Collector());
         case 'c': return std::unique_ptr<Collector>(new StringsCollector(row_count, encoding));
+        case 'f': return std::unique_ptr<Collector>(new FactorCollector(row_count, encoding));
         case 'i': return std::unique_ptr<Collector>(new IntegersCollector(row_count));
         case 'd': return std::unique_ptr<Collector>(new DoublesCollector(row_count));
         case 'l': return std::unique_ptr<Collector>(new LogicalsCollector(row_count, dbf_type));
@@ -512,6 +1346,147 @@ private:
 };
 
 
+// The rows to read from a DBF file: either a contiguous range of records or
+// an arbitrary vector of (zero-based) record indices where NA_INTEGER
+// reads as an all-NA row. Records have a fixed size, so any record can be
+// read without reading the ones before it.
+class DBFRows {
+public:
+    DBFRows(int record_start, int size): 
+        record_start(record_start), size_(size), records(nullptr) {}
+    DBFRows(const int* records, int size): 
+        record_start(0), size_(size), records(records) {}
+
+    int size() const {
+        return size_;
+    }
+
+    int record(int row_index) const {
+        if (records == nullptr) {
+            return record_start + row_index;
+        } else if (records[row_index] == NA_INTEGER) {
+            return -1;
+        } else {
+            return records[row_index];
+        }
+    }
+
+private:
+    int record_start;
+    int size_;
+    const int* records;
+};
+
+// Threads are only worth it when there's enough work to split
+#ifndef DBF_MIN_ROWS_PER_THREAD
+#define DBF_MIN_ROWS_PER_THREAD 10000
+#endif
+
+// Sequential reads load this many bytes worth of records at a time
+#ifndef DBF_READ_BLOCK_SIZE
+#define DBF_READ_BLOCK_SIZE 262144
+#endif
+
+// Reads a range of rows for a set of (thread safe) collectors on a
+// separate thread. Each worker has its own DBF handle because the
+// underlying DBFHandle caches the current record and isn't thread safe.
+// Handles are opened on the main thread so that a failure to open
+// can be reported using stop().
+class DBFWorker {
+public:
+    DBFWorker(const std::string& filename, const std::string& encoding, int read_block_size,
+              int row_start, int row_end):
+        dbf(filename, encoding), row_start(row_start), row_end(row_end) {
+        dbf.set_read_block_size(read_block_size);
+    }
+
+    void run(std::vector<std::unique_ptr<Collector>>& collectors, const std::vector<int>& fields,
+             const DBFRows& rows, std::atomic<bool>& cancelled) {
+        try {
+            for (int row_index = row_start; row_index < row_end; row_index++) {
+                if ((row_index % 1000 == 0) && cancelled.load()) {
+                    return;
+                }
+
+                int record_index = rows.record(row_index);
+                for (int field_index: fields) {
+                    collectors[field_index]->put(dbf, problems, record_index, row_index, field_index);
+                }
+            }
+        } catch (std::exception& e) {
+            error = e.what();
+        } catch (...) {
+            error = "Unknown error in DBF worker thread";
+        }
+    }
+
+    Problems problems;
+    std::string error;
+
+private:
+    DBFFile dbf;
+    int row_start;
+    int row_end;
+};
+
+// Owns the worker threads. The destructor cancels and joins any running threads
+// so that an error or interrupt on the main thread (which unwinds the stack)
+// never leaves a thread running that writes to memory that R may have freed.
+class DBFWorkerPool {
+public:
+    DBFWorkerPool(): cancelled(false) {}
+
+    void start(const std::string& filename, const std::string& encoding, int read_block_size,
+               const DBFRows& rows, int num_threads,
+               std::vector<std::unique_ptr<Collector>>& collectors, const std::vector<int>& fields) {
+        int row_count = rows.size();
+        int chunk_size = (row_count + num_threads - 1) / num_threads;
+        for (int row_start = 0; row_start < row_count; row_start += chunk_size) {
+            int row_end = std::min(row_start + chunk_size, row_count);
+            workers.push_back(std::unique_ptr<DBFWorker>(
+                new DBFWorker(filename, encoding, read_block_size, row_start, row_end)
+            ));
+        }
+
+        for (auto& worker: workers) {
+            DBFWorker* worker_ptr = worker.get();
+            threads.push_back(std::thread([worker_ptr, &collectors, &fields, &rows, this]() {
+                worker_ptr->run(collectors, fields, rows, this->cancelled);
+            }));
+        }
+    }
+
+    // Join all threads and merge their problems into `problems`
+    void finish(Problems& problems) {
+        join();
+        for (auto& worker: workers) {
+            if (worker->error != "") {
+                stop(worker->error);
+            }
+
+            problems.merge(worker->problems);
+        }
+    }
+
+    ~DBFWorkerPool() {
+        cancelled.store(true);
+        join();
+    }
+
+private:
+    std::atomic<bool> cancelled;
+    std::vector<std::unique_ptr<DBFWorker>> workers;
+    std::vector<std::thread> threads;
+
+    void join() {
+        for (auto& thread: threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+};
+
 [[cpp11::register]]
 list cpp_dbf_meta(std::string filename) {
     DBFFile dbf(filename);
@@ -550,16 +1525,44 @@ list cpp_dbf_colmeta(std::string filename) {
     return result;
 }
 
-[[cpp11::register]]
-list cpp_read_dbf(std::string filename, std::string col_spec, std::string encoding) {
-    DBFFile dbf(filename, encoding);
-
+// Reads rows from an open DBFFile into a list() of R vectors. This is shared
+// by cpp_read_dbf() (which reads a file in one go) and cpp_read_dbf_chunk()
+// (which reads successive chunks from a file that stays open).
+list dbf_read(DBFFile& dbf, std::string col_spec, int skip, int n_max, sexp rows, int num_threads) {
     int field_count = dbf.field_count();
-    int row_count = dbf.row_count();
+    int record_count = dbf.row_count();
+
+    // Resolve which records to read: `rows` (zero-based record indices) if
+    // specified or a range based on `skip` and `n_max` (-1 for no maximum).
+    std::unique_ptr<DBFRows> selected_rows;
+    int read_block_size = DBF_READ_BLOCK_SIZE;
+    if (rows == R_NilValue) {
+        int record_start = std::min(std::max(skip, 0), record_count);
+        int size = record_count - record_start;
+        if ((n_max >= 0) && (n_max < size)) {
+            size = n_max;
+        }
+
+        selected_rows.reset(new DBFRows(record_start, size));
+    } else {
+        const int* records = INTEGER(rows);
+        int size = Rf_length(rows);
+        for (int i = 0; i < size; i++) {
+            if ((records[i] != NA_INTEGER) && ((records[i] < 0) || (records[i] >= record_count))) {
+                stop("Can't read row %d from DBF with %d rows", records[i] + 1, record_count);
+            }
+        }
+
+        // Block reads load records that a sparse selection will never use
+        if (size < (record_count / 16)) {
+            read_block_size = 0;
+        }
 
-    // Make sure the C locale for parsing numerics is consistent.
-    // The deleter will restore the current C locale on exit.
-    ThreadLocalizer localizer;
+        selected_rows.reset(new DBFRows(records, size));
+    }
+
+    dbf.set_read_block_size(read_block_size);
+    int row_count = selected_rows->size();
 
     // Iterate over columns to get names and type information.
     CollectorFactory collector_factory(dbf);
@@ -598,18 +1601,50 @@ list cpp_read_dbf(std::string filename, std::string col_spec, std::string encodi
     // Use a Problems object to accumulate parse errors
     Problems problems;
 
+    // Split fields into those that can be read by worker threads and
+    // those that must be read on this thread
+    int max_threads = std::max(row_count / DBF_MIN_ROWS_PER_THREAD, 1);
+    num_threads = std::min(num_threads, max_threads);
+
+    // Skipped fields are left out entirely so that reading a few columns
+    // from a wide file only does the work for those columns
+    std::vector<int> main_fields;
+    std::vector<int> worker_fields;
+    for (int field_index = 0; field_index < field_count; field_index++) {
+        if (collectors[field_index]->is_skipped()) {
+            continue;
+        } else if ((num_threads > 1) && collectors[field_index]->is_thread_safe()) {
+            worker_fields.push_back(field_index);
+        } else {
+            main_fields.push_back(field_index);
+        }
+    }
+
+    DBFWorkerPool pool;
+    if (worker_fields.size() > 0) {
+        pool.start(
+            dbf.filename(), dbf.encoding(), read_block_size, 
+            *selected_rows, num_threads, collectors, worker_fields
+        );
+    }
+
     // Iterate over rows then columns and let the collectors handle conversion
     // to R vector values.
-    for (int row_index = 0; row_index < row_count; row_index++) {
-        if ((row_index + 1) % 1000 == 0) {
-            check_user_interrupt();
-        }
+    if (main_fields.size() > 0) {
+        for (int row_index = 0; row_index < row_count; row_index++) {
+            if ((row_index + 1) % 1000 == 0) {
+                check_user_interrupt();
+            }
 
-        for (int field_index = 0; field_index < field_count; field_index++) {
-            collectors[field_index]->put(dbf, problems, row_index, field_index);
+            int record_index = selected_rows->record(row_index);
+            for (int field_index: main_fields) {
+                collectors[field_index]->put(dbf, problems, record_index, row_index, field_index);
+            }
         }
     }
 
+    pool.finish(problems);
+
     // Assemble results as a list(). Note that "skipped" columns will be R_NilValue
     writable::list result(field_count);
     for (int field_index = 0; field_index < field_count; field_index++) {
@@ -624,3 +1659,36 @@ list cpp_read_dbf(std::string filename, std::string col_spec, std::string encodi
     result.attr("problems") = problems.result();
     return result;
 }
+
+[[cpp11::register]]
+list cpp_read_dbf(std::string filename, std::string col_spec, std::string encoding,
+                  int skip, int n_max, sexp rows, int num_threads) {
+    DBFFile dbf(filename, encoding);
+    return dbf_read(dbf, col_spec, skip, n_max, rows, num_threads);
+}
+
+// These functions keep a DBFFile open between calls (e.g., to read a
+// file in chunks). The file is closed when cpp_dbf_close() is called or
+// when the external pointer is garbage collected.
+[[cpp11::register]]
+sexp cpp_dbf_open(std::string filename, std::string encoding) {
+    external_pointer<DBFFile> dbf(new DBFFile(filename, encoding));
+    return sexp(dbf);
+}
+
+[[cpp11::register]]
+list cpp_read_dbf_chunk(sexp dbf_xptr, std::string col_spec, int skip, int n_max, int num_threads) {
+    external_pointer<DBFFile> dbf(dbf_xptr);
+    if (dbf.get() == nullptr) {
+        stop("Can't read from a DBF file that has been closed");
+    }
+
+    return dbf_read(*dbf.get(), col_spec, skip, n_max, R_NilValue, num_threads);
+}
+
+[[cpp11::register]]
+void cpp_dbf_close(sexp dbf_xptr) {
+    external_pointer<DBFFile> dbf(dbf_xptr);
+    dbf.reset();
+}
+
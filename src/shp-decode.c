@@ -0,0 +1,430 @@
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shp-decode.h"
+
+void shp_decode_buffer_init(shp_decode_buffer_t* buffer) {
+    memset(buffer, 0, sizeof(shp_decode_buffer_t));
+}
+
+void shp_decode_buffer_reset(shp_decode_buffer_t* buffer) {
+    buffer->coords_size = 0;
+    buffer->ints_size = 0;
+}
+
+void shp_decode_buffer_free(shp_decode_buffer_t* buffer) {
+    free(buffer->coords);
+    free(buffer->ints);
+    free(buffer->ring_info);
+    free(buffer->ring_bounds);
+    shp_decode_buffer_init(buffer);
+}
+
+static int shp_decode_reserve_coords(shp_decode_buffer_t* buffer, size_t n, char* error_buf) {
+    size_t required = buffer->coords_size + n;
+    if (required <= buffer->coords_capacity) {
+        return 0;
+    }
+
+    size_t capacity = buffer->coords_capacity * 2;
+    if (capacity < required) {
+        capacity = required;
+    }
+
+    double* coords = (double*) realloc(buffer->coords, sizeof(double) * capacity);
+    if (coords == NULL) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Failed to allocate %lu coordinate values",
+                 (unsigned long) capacity);
+        return 1;
+    }
+
+    buffer->coords = coords;
+    buffer->coords_capacity = capacity;
+    return 0;
+}
+
+static int shp_decode_reserve_ints(shp_decode_buffer_t* buffer, size_t n, char* error_buf) {
+    size_t required = buffer->ints_size + n;
+    if (required <= buffer->ints_capacity) {
+        return 0;
+    }
+
+    size_t capacity = buffer->ints_capacity * 2;
+    if (capacity < required) {
+        capacity = required;
+    }
+
+    uint32_t* ints = (uint32_t*) realloc(buffer->ints, sizeof(uint32_t) * capacity);
+    if (ints == NULL) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Failed to allocate %lu part values",
+                 (unsigned long) capacity);
+        return 1;
+    }
+
+    buffer->ints = ints;
+    buffer->ints_capacity = capacity;
+    return 0;
+}
+
+static int shp_decode_reserve_rings(shp_decode_buffer_t* buffer, uint32_t n_rings, char* error_buf) {
+    if (n_rings <= buffer->ring_info_size) {
+        return 0;
+    }
+
+    // ring_polygon, next_ring, polygon_head, polygon_tail
+    uint32_t* ring_info = (uint32_t*) realloc(buffer->ring_info, sizeof(uint32_t) * 4 * n_rings);
+    if (ring_info == NULL) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Failed to allocate ring scratch space for %u rings", n_rings);
+        return 1;
+    }
+    buffer->ring_info = ring_info;
+
+    double* ring_bounds = (double*) realloc(buffer->ring_bounds, sizeof(double) * 4 * n_rings);
+    if (ring_bounds == NULL) {
+        snprintf(error_buf, SHP_ERROR_SIZE, "Failed to allocate ring scratch space for %u rings", n_rings);
+        return 1;
+    }
+    buffer->ring_bounds = ring_bounds;
+
+    buffer->ring_info_size = n_rings;
+    return 0;
+}
+
+void shp_decode_null(shp_decoded_shape_t* decoded) {
+    memset(decoded, 0, sizeof(shp_decoded_shape_t));
+    decoded->shape_type = SHP_TYPE_NULL;
+    decoded->coord_size = 2;
+}
+
+void shp_decode_coords(const shp_shape_t* shape, uint32_t start, uint32_t end,
+                       int has_z, int has_m, unsigned char* dest) {
+    uint32_t coord_size = 2 + (has_z != 0) + (has_m != 0);
+    size_t stride = sizeof(double) * coord_size;
+
+#ifdef IS_LITTLE_ENDIAN
+    // x and y are already interleaved native doubles
+    if (coord_size == 2) {
+        memcpy(dest, shape->xy + start * 16, 16 * (size_t) (end - start));
+        return;
+    }
+#endif
+
+    double value;
+    for (uint32_t i = start; i < end; i++) {
+        unsigned char* coord = dest + (i - start) * stride;
+        value = shp_le_double(shape->xy + i * 16);
+        memcpy(coord, &value, sizeof(double));
+        value = shp_le_double(shape->xy + i * 16 + 8);
+        memcpy(coord + sizeof(double), &value, sizeof(double));
+    }
+
+    uint32_t dim = 2;
+    if (has_z) {
+        for (uint32_t i = start; i < end; i++) {
+            value = (shape->z != NULL) ? shp_le_double(shape->z + i * 8) : NAN;
+            memcpy(dest + (i - start) * stride + dim * sizeof(double), &value, sizeof(double));
+        }
+
+        dim++;
+    }
+
+    if (has_m) {
+        for (uint32_t i = start; i < end; i++) {
+            value = (shape->m != NULL) ? shp_le_double(shape->m + i * 8) : NAN;
+            if (shp_measure_is_nodata(value)) {
+                value = NAN;
+            }
+
+            memcpy(dest + (i - start) * stride + dim * sizeof(double), &value, sizeof(double));
+        }
+    }
+}
+
+// Computes the signed area (positive for counterclockwise rings) and the
+// XY bounds of a ring in one pass.
+static double shp_ring_signed_area(const double* coords, uint32_t coord_size,
+                                   uint32_t start, uint32_t end, double* bounds) {
+    if (start == end) {
+        bounds[0] = bounds[1] = INFINITY;
+        bounds[2] = bounds[3] = -INFINITY;
+        return 0;
+    }
+
+    // use coordinates relative to the first vertex for numerical stability
+    double x0 = coords[start * coord_size];
+    double y0 = coords[start * coord_size + 1];
+    bounds[0] = bounds[2] = x0;
+    bounds[1] = bounds[3] = y0;
+
+    double area = 0;
+    double x_prev = 0;
+    double y_prev = 0;
+    double x, y;
+    for (uint32_t i = start + 1; i < end; i++) {
+        x = coords[i * coord_size];
+        y = coords[i * coord_size + 1];
+
+        if (x < bounds[0]) bounds[0] = x;
+        if (y < bounds[1]) bounds[1] = y;
+        if (x > bounds[2]) bounds[2] = x;
+        if (y > bounds[3]) bounds[3] = y;
+
+        x -= x0;
+        y -= y0;
+        area += x_prev * y - x * y_prev;
+        x_prev = x;
+        y_prev = y;
+    }
+
+    return area / 2;
+}
+
+// Crossing number test: is (x, y) inside the ring?
+static int shp_ring_contains(const double* coords, uint32_t coord_size,
+                             uint32_t start, uint32_t end, double x, double y) {
+    int inside = 0;
+    double xi, yi, xj, yj;
+    for (uint32_t i = start, j = end - 1; i < end; j = i++) {
+        xi = coords[i * coord_size];
+        yi = coords[i * coord_size + 1];
+        xj = coords[j * coord_size];
+        yj = coords[j * coord_size + 1];
+
+        if (((yi > y) != (yj > y)) && (x < ((xj - xi) * (y - yi) / (yj - yi) + xi))) {
+            inside = !inside;
+        }
+    }
+
+    return inside;
+}
+
+static int shp_ring_maybe_contains(const double* coords, uint32_t coord_size, const uint32_t* parts,
+                                   const double* bounds, uint32_t ring, double x, double y) {
+    const double* ring_bounds = bounds + ring * 4;
+    if ((x < ring_bounds[0]) || (x > ring_bounds[2]) ||
+        (y < ring_bounds[1]) || (y > ring_bounds[3])) {
+        return 0;
+    }
+
+    return shp_ring_contains(coords, coord_size, parts[ring], parts[ring + 1], x, y);
+}
+
+// Shapefile polygons are a flat list of rings: outer rings are clockwise and
+// inner rings (holes) are counterclockwise. There's no guarantee that holes
+// follow the ring that contains them, so we check the ring with the
+// closest preceding outer ring first and fall back to checking all of them.
+// Holes that aren't contained by any outer ring (or all rings in a polygon
+// that was written with the wrong winding order) become their own polygon.
+static int shp_decode_polygon_rings(shp_decode_buffer_t* buffer, shp_decoded_shape_t* decoded,
+                                    char* error_buf) {
+    uint32_t n_rings = decoded->n_parts;
+    if (shp_decode_reserve_rings(buffer, n_rings, error_buf) != 0 ||
+        shp_decode_reserve_ints(buffer, (size_t) n_rings * 2, error_buf) != 0) {
+        return 1;
+    }
+
+    const double* coords = buffer->coords + decoded->coords;
+    const uint32_t* parts = buffer->ints + decoded->parts;
+    uint32_t coord_size = decoded->coord_size;
+
+    uint32_t* ring_polygon = buffer->ring_info;
+    uint32_t* next_ring = ring_polygon + n_rings;
+    uint32_t* polygon_head = next_ring + n_rings;
+    uint32_t* polygon_tail = polygon_head + n_rings;
+    uint32_t* polygon_size = buffer->ints + buffer->ints_size + n_rings;
+    double* bounds = buffer->ring_bounds;
+
+    uint32_t n_outer = 0;
+    for (uint32_t i = 0; i < n_rings; i++) {
+        double area = shp_ring_signed_area(coords, coord_size, parts[i], parts[i + 1], bounds + i * 4);
+
+        next_ring[i] = UINT32_MAX;
+        if (area <= 0) {
+            ring_polygon[i] = n_outer;
+            polygon_head[n_outer] = i;
+            polygon_tail[n_outer] = i;
+            polygon_size[n_outer] = 1;
+            n_outer++;
+        } else {
+            ring_polygon[i] = UINT32_MAX;
+        }
+    }
+
+    uint32_t n_polygons = n_outer;
+    uint32_t last_outer = UINT32_MAX;
+    for (uint32_t i = 0; i < n_rings; i++) {
+        if (ring_polygon[i] != UINT32_MAX) {
+            last_outer = i;
+            continue;
+        }
+
+        uint32_t start = parts[i];
+        uint32_t end = parts[i + 1];
+        uint32_t polygon = UINT32_MAX;
+
+        if (n_outer == 1) {
+            polygon = 0;
+        } else if ((n_outer > 1) && (start < end)) {
+            double x = coords[start * coord_size];
+            double y = coords[start * coord_size + 1];
+
+            if ((last_outer != UINT32_MAX) &&
+                shp_ring_maybe_contains(coords, coord_size, parts, bounds, last_outer, x, y)) {
+                polygon = ring_polygon[last_outer];
+            } else {
+                for (uint32_t j = 0; j < n_outer; j++) {
+                    uint32_t outer = polygon_head[j];
+                    if ((outer != last_outer) &&
+                        shp_ring_maybe_contains(coords, coord_size, parts, bounds, outer, x, y)) {
+                        polygon = j;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (polygon == UINT32_MAX) {
+            ring_polygon[i] = n_polygons;
+            polygon_head[n_polygons] = i;
+            polygon_tail[n_polygons] = i;
+            polygon_size[n_polygons] = 1;
+            n_polygons++;
+        } else {
+            ring_polygon[i] = polygon;
+            next_ring[polygon_tail[polygon]] = i;
+            polygon_tail[polygon] = i;
+            polygon_size[polygon]++;
+        }
+    }
+
+    // Flatten the linked list of rings for each polygon
+    uint32_t* rings = buffer->ints + buffer->ints_size;
+    uint32_t n_written = 0;
+    for (uint32_t i = 0; i < n_polygons; i++) {
+        for (uint32_t ring = polygon_head[i]; ring != UINT32_MAX; ring = next_ring[ring]) {
+            rings[n_written++] = ring;
+        }
+    }
+
+    decoded->n_polygons = n_polygons;
+    decoded->rings = buffer->ints_size;
+    decoded->polygon_size = buffer->ints_size + n_rings;
+    buffer->ints_size += n_rings + n_polygons;
+    return 0;
+}
+
+uint32_t shp_decode_multipatch_n_holes(const uint32_t* part_types, uint32_t n_parts, uint32_t part) {
+    uint32_t hole_type;
+    switch (part_types[part]) {
+    case SHP_PART_TRIANGLE_STRIP:
+    case SHP_PART_TRIANGLE_FAN:
+        return UINT32_MAX;
+    case SHP_PART_OUTER_RING:
+        hole_type = SHP_PART_INNER_RING;
+        break;
+    case SHP_PART_FIRST_RING:
+        hole_type = SHP_PART_RING;
+        break;
+    default:
+        return 0;
+    }
+
+    uint32_t n_holes = 0;
+    for (uint32_t i = part + 1; i < n_parts; i++) {
+        if (part_types[i] != hole_type) {
+            break;
+        }
+        n_holes++;
+    }
+
+    return n_holes;
+}
+
+int shp_decode_shape(const shp_shape_t* shape, shp_decode_buffer_t* buffer,
+                     shp_decoded_shape_t* decoded, char* error_buf) {
+    memset(decoded, 0, sizeof(shp_decoded_shape_t));
+    decoded->shape_type = shape->shape_type;
+    decoded->has_z = shape->z != NULL;
+    decoded->has_m = shape->m != NULL;
+    decoded->coord_size = 2 + decoded->has_z + decoded->has_m;
+
+    switch (shape->shape_type) {
+    case SHP_TYPE_NULL:
+        return 0;
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+    case SHP_TYPE_MULTIPATCH:
+        break;
+    default:
+        // the handler reports shape types it doesn't know about
+        return 0;
+    }
+
+    decoded->n_points = shape->n_points;
+    decoded->n_parts = shape->n_parts;
+
+    size_t n_coords = (size_t) shape->n_points * decoded->coord_size;
+    if (shp_decode_reserve_coords(buffer, n_coords, error_buf) != 0) {
+        return 1;
+    }
+
+    decoded->coords = buffer->coords_size;
+    shp_decode_coords(
+        shape, 0, shape->n_points,
+        decoded->has_z, decoded->has_m,
+        (unsigned char*) (buffer->coords + buffer->coords_size)
+    );
+    buffer->coords_size += n_coords;
+
+    if (shape->parts == NULL) {
+        return 0;
+    }
+
+    // part boundaries (with n_points at the end) followed by part types
+    size_t n_ints = (size_t) shape->n_parts + 1;
+    if (shape->part_types != NULL) {
+        n_ints += shape->n_parts;
+    }
+
+    if (shp_decode_reserve_ints(buffer, n_ints, error_buf) != 0) {
+        return 1;
+    }
+
+    uint32_t* parts = buffer->ints + buffer->ints_size;
+    for (uint32_t i = 0; i < shape->n_parts; i++) {
+        parts[i] = shp_le_uint32(shape->parts + i * 4);
+    }
+    parts[shape->n_parts] = shape->n_points;
+    decoded->parts = buffer->ints_size;
+
+    if (shape->part_types != NULL) {
+        uint32_t* part_types = parts + shape->n_parts + 1;
+        for (uint32_t i = 0; i < shape->n_parts; i++) {
+            part_types[i] = shp_le_uint32(shape->part_types + i * 4);
+        }
+        decoded->part_types = decoded->parts + shape->n_parts + 1;
+    }
+
+    buffer->ints_size += n_ints;
+
+    switch (shape->shape_type) {
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+        return shp_decode_polygon_rings(buffer, decoded, error_buf);
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,114 @@
+
+#ifndef SHP_DECODE_H
+#define SHP_DECODE_H
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#include "minishp-shp.h"
+
+// A shape decoded into native doubles with its rings grouped into
+// polygons, ready to be passed to a handler without looking at the
+// record again. Arrays are stored as offsets into the coords and ints of
+// the shp_decode_buffer_t the shape was decoded into so that they stay
+// valid when the buffer grows.
+typedef struct {
+    uint32_t shape_type;
+    int has_z;
+    int has_m;
+    // the number of doubles per coordinate (2, 3, or 4)
+    uint32_t coord_size;
+    uint32_t n_points;
+    uint32_t n_parts;
+    // the number of polygons for (multi)polygons
+    uint32_t n_polygons;
+    // n_points * coord_size doubles (x, y[, z][, m]; missing measures are NaN)
+    size_t coords;
+    // n_parts + 1 part boundaries (the last one is n_points)
+    size_t parts;
+    // n_parts part types (multipatches only)
+    size_t part_types;
+    // n_parts ring ids in output order and n_polygons ring counts (polygons only)
+    size_t rings;
+    size_t polygon_size;
+} shp_decoded_shape_t;
+
+typedef struct {
+    double* coords;
+    size_t coords_size;
+    size_t coords_capacity;
+    uint32_t* ints;
+    size_t ints_size;
+    size_t ints_capacity;
+    // scratch space used to group polygon rings
+    uint32_t* ring_info;
+    double* ring_bounds;
+    uint32_t ring_info_size;
+} shp_decode_buffer_t;
+
+// A batch of consecutive features decoded by a worker thread. If a feature
+// couldn't be read, `size` features were decoded before it, `error_i` is
+// its position, and `error_buf` contains the reason.
+typedef struct {
+    int64_t start;
+    int64_t size;
+    int64_t error_i;
+    char error_buf[SHP_ERROR_SIZE];
+    const shp_decoded_shape_t* shapes;
+    const shp_decode_buffer_t* buffer;
+} shp_decoded_batch_t;
+
+typedef struct shp_decoder_t shp_decoder_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void shp_decode_buffer_init(shp_decode_buffer_t* buffer);
+void shp_decode_buffer_reset(shp_decode_buffer_t* buffer);
+void shp_decode_buffer_free(shp_decode_buffer_t* buffer);
+
+// Decodes `shape` into `buffer` (appending to whatever it already
+// contains). These functions don't use the R API and are safe to call
+// from any thread for a buffer owned by that thread. Returns 0 on success.
+int shp_decode_shape(const shp_shape_t* shape, shp_decode_buffer_t* buffer,
+                     shp_decoded_shape_t* decoded, char* error_buf);
+void shp_decode_null(shp_decoded_shape_t* decoded);
+
+// Writes coordinates start to end of `shape` as interleaved native doubles
+// (x, y[, z][, m]) to `dest`, which need not be aligned. Dimensions that
+// the record doesn't contain (and missing measures) are written as NaN.
+void shp_decode_coords(const shp_shape_t* shape, uint32_t start, uint32_t end,
+                       int has_z, int has_m, unsigned char* dest);
+
+// MultiPatch parts are triangle strips, triangle fans, or rings. Returns the
+// number of parts after `part` that are holes of the polygon starting at
+// `part` (or UINT32_MAX if `part` isn't a ring).
+uint32_t shp_decode_multipatch_n_holes(const uint32_t* part_types, uint32_t n_parts, uint32_t part);
+
+// Decodes the shapes for zero-based `indices` (NA_INTEGER for a null
+// feature) on `num_threads` worker threads. `shp` must be memory-mapped
+// and its .shx loaded (see shp_read_shape_mapped()); `shp` and `indices`
+// must stay valid until shp_decoder_stop(). Returns NULL if the threads
+// couldn't be started.
+shp_decoder_t* shp_decoder_start(shp_file_t* shp, const int* indices, int64_t size,
+                                 int num_threads);
+
+// Waits for and returns the next batch in order (or NULL after the last
+// one). The previous batch is recycled and must no longer be used.
+const shp_decoded_batch_t* shp_decoder_next(shp_decoder_t* decoder);
+
+// Cancels and joins the worker threads and frees the decoder. This
+// is safe to call at any point (including from a cleanup function).
+void shp_decoder_stop(shp_decoder_t* decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "shp-decode.h"
+
+// The number of features decoded by a worker at a time
+#ifndef SHP_DECODE_BATCH_SIZE
+#define SHP_DECODE_BATCH_SIZE 1024
+#endif
+
+// The number of batches that may be decoded ahead of the batch being
+// handled (per thread)
+#ifndef SHP_DECODE_BATCHES_PER_THREAD
+#define SHP_DECODE_BATCHES_PER_THREAD 4
+#endif
+
+// A slot that holds one batch of decoded shapes. Slots are reused in turn:
+// batch i is decoded into slot i % n_slots once batch i - n_slots has been
+// handled.
+class DecodedBatch {
+public:
+    DecodedBatch(): id(-1), ready(false) {
+        shp_decode_buffer_init(&buffer);
+    }
+
+    ~DecodedBatch() {
+        shp_decode_buffer_free(&buffer);
+    }
+
+    int64_t id;
+    bool ready;
+    std::vector<shp_decoded_shape_t> shapes;
+    shp_decode_buffer_t buffer;
+    shp_decoded_batch_t result;
+};
+
+// Owns the worker threads. Workers claim batches in order and only read
+// from the (memory-mapped) file and write to their batch, so they never
+// touch the R API. Destroying the decoder cancels and joins all threads.
+struct shp_decoder_t {
+public:
+    shp_decoder_t(shp_file_t* shp, const int* indices, int64_t size, int num_threads):
+        shp(shp), indices(indices), size(size),
+        n_batches((size + SHP_DECODE_BATCH_SIZE - 1) / SHP_DECODE_BATCH_SIZE),
+        next_claim(0), next_handle(0), has_current(false), cancelled(false) {
+        int64_t n_slots = (int64_t) num_threads * SHP_DECODE_BATCHES_PER_THREAD;
+        for (int64_t i = 0; i < n_slots; i++) {
+            slots.push_back(std::unique_ptr<DecodedBatch>(new DecodedBatch()));
+        }
+
+        try {
+            for (int i = 0; i < num_threads; i++) {
+                threads.push_back(std::thread([this]() { this->run(); }));
+            }
+        } catch (...) {
+            // the destructor isn't called if the constructor throws
+            join();
+            throw;
+        }
+    }
+
+    ~shp_decoder_t() {
+        join();
+    }
+
+    const shp_decoded_batch_t* next() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (has_current) {
+            slot(next_handle).ready = false;
+            next_handle++;
+            has_current = false;
+            slot_free.notify_all();
+        }
+
+        if (next_handle >= n_batches) {
+            return nullptr;
+        }
+
+        DecodedBatch& batch = slot(next_handle);
+        int64_t batch_id = next_handle;
+        batch_ready.wait(lock, [&]() { return batch.ready && batch.id == batch_id; });
+        has_current = true;
+        return &batch.result;
+    }
+
+private:
+    shp_file_t* shp;
+    const int* indices;
+    int64_t size;
+    int64_t n_batches;
+
+    std::vector<std::unique_ptr<DecodedBatch>> slots;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable batch_ready;
+    std::condition_variable slot_free;
+    int64_t next_claim;
+    int64_t next_handle;
+    bool has_current;
+    bool cancelled;
+
+    void join() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+        }
+
+        slot_free.notify_all();
+        for (auto& thread: threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    DecodedBatch& slot(int64_t batch_id) {
+        return *slots[batch_id % slots.size()];
+    }
+
+    void run() {
+        int64_t n_slots = slots.size();
+        while (true) {
+            int64_t batch_id;
+            DecodedBatch* batch;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (cancelled || next_claim >= n_batches) {
+                    return;
+                }
+
+                batch_id = next_claim++;
+                batch = &slot(batch_id);
+
+                // wait for the previous batch in this slot to be handled
+                slot_free.wait(lock, [&]() { return cancelled || (batch_id - n_slots) < next_handle; });
+                if (cancelled) {
+                    return;
+                }
+
+                batch->id = batch_id;
+                batch->ready = false;
+            }
+
+            decode(batch_id, *batch);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch->ready = true;
+            }
+
+            batch_ready.notify_all();
+        }
+    }
+
+    void decode(int64_t batch_id, DecodedBatch& batch) {
+        int64_t start = batch_id * SHP_DECODE_BATCH_SIZE;
+        int64_t end = std::min<int64_t>(start + SHP_DECODE_BATCH_SIZE, size);
+        shp_decoded_batch_t& result = batch.result;
+        result.start = start;
+        result.size = 0;
+        result.error_i = -1;
+        result.error_buf[0] = '\0';
+
+        try {
+            batch.shapes.resize(end - start);
+            shp_decode_buffer_reset(&batch.buffer);
+
+            shp_shape_t shape;
+            for (int64_t i = start; i < end; i++) {
+                shp_decoded_shape_t* decoded = batch.shapes.data() + (i - start);
+
+                // INT_MIN is NA_INTEGER
+                if (indices[i] == INT_MIN) {
+                    shp_decode_null(decoded);
+                } else if (shp_read_shape_mapped(shp, indices[i], &shape, result.error_buf) != 0 ||
+                           shp_decode_shape(&shape, &batch.buffer, decoded, result.error_buf) != 0) {
+                    result.error_i = i;
+                    break;
+                }
+
+                result.size++;
+            }
+        } catch (std::exception& e) {
+            result.error_i = start + result.size;
+            snprintf(result.error_buf, SHP_ERROR_SIZE, "%s", e.what());
+        }
+
+        result.shapes = batch.shapes.data();
+        result.buffer = &batch.buffer;
+    }
+};
+
+shp_decoder_t* shp_decoder_start(shp_file_t* shp, const int* indices, int64_t size,
+                                 int num_threads) {
+    if (num_threads < 1 || size <= 0) {
+        return nullptr;
+    }
+
+    // there's no point in having more threads than batches
+    int64_t n_batches = (size + SHP_DECODE_BATCH_SIZE - 1) / SHP_DECODE_BATCH_SIZE;
+    num_threads = (int) std::min<int64_t>(num_threads, n_batches);
+
+    try {
+        return new shp_decoder_t(shp, indices, size, num_threads);
+    } catch (...) {
+        // e.g., threads aren't available (the caller decodes on its own thread)
+        return nullptr;
+    }
+}
+
+const shp_decoded_batch_t* shp_decoder_next(shp_decoder_t* decoder) {
+    return decoder->next();
+}
+
+void shp_decoder_stop(shp_decoder_t* decoder) {
+    delete decoder;
+}
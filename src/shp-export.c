@@ -0,0 +1,655 @@
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <R.h>
+#include <Rinternals.h>
+#include "minishp-shp.h"
+#include "shp-decode.h"
+#include "shp-file-cache.h"
+
+// WKB is written in native byte order with EWKB dimension flags (as
+// written by wk::wkb_writer())
+#ifdef IS_LITTLE_ENDIAN
+#define SHP_WKB_ENDIAN 1
+#else
+#define SHP_WKB_ENDIAN 0
+#endif
+
+#define SHP_EWKB_Z_BIT 0x80000000
+#define SHP_EWKB_M_BIT 0x40000000
+
+enum shp_wkb_type {
+    SHP_WKB_POINT = 1,
+    SHP_WKB_LINESTRING = 2,
+    SHP_WKB_POLYGON = 3,
+    SHP_WKB_MULTIPOINT = 4,
+    SHP_WKB_MULTILINESTRING = 5,
+    SHP_WKB_MULTIPOLYGON = 6
+};
+
+// Exporters write coordinates straight from the record bytes into the
+// output (i.e., without a handler call per coordinate). Polygons and
+// multipatches are also decoded to group their rings into polygons.
+typedef struct {
+    SEXP shp_geometry;
+    shp_file_t* shp;
+    shp_decode_buffer_t buffer;
+} shp_exporter_t;
+
+static void shp_exporter_cleanup(void* data) {
+    shp_exporter_t* exporter = (shp_exporter_t*) data;
+    shp_file_cache_release(exporter->shp);
+    shp_decode_buffer_free(&exporter->buffer);
+}
+
+static void shp_exporter_open(shp_exporter_t* exporter) {
+    SEXP shp_file = Rf_getAttrib(exporter->shp_geometry, Rf_install("file"));
+    const char* filename = Rf_translateCharUTF8(STRING_ELT(shp_file, 0));
+    exporter->shp = shp_file_cache_acquire(filename);
+    if (!shp_valid(exporter->shp)) {
+        Rf_error("%s", exporter->shp->error_buf);
+    }
+
+    shx_load_if_dense(shp_open_shx(exporter->shp), Rf_xlength(exporter->shp_geometry));
+}
+
+static int shp_export_needs_decode(uint32_t shape_type) {
+    switch (shape_type) {
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+    case SHP_TYPE_MULTIPATCH:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void shp_exporter_read(shp_exporter_t* exporter, R_xlen_t i, int shape_id,
+                              shp_shape_t* shape, shp_decoded_shape_t* decoded) {
+    if (shp_read_shape(exporter->shp, shape_id, shape) != 0) {
+        Rf_error("[i=%ld] %s", (long) i + 1, exporter->shp->error_buf);
+    }
+
+    if (shp_export_needs_decode(shape->shape_type)) {
+        shp_decode_buffer_reset(&exporter->buffer);
+        if (shp_decode_shape(shape, &exporter->buffer, decoded, exporter->shp->error_buf) != 0) {
+            Rf_error("[i=%ld] %s", (long) i + 1, exporter->shp->error_buf);
+        }
+    }
+}
+
+static inline unsigned char* shp_wkb_write_uint32(unsigned char* dest, uint32_t value) {
+    memcpy(dest, &value, sizeof(uint32_t));
+    return dest + sizeof(uint32_t);
+}
+
+static inline unsigned char* shp_wkb_write_header(unsigned char* dest, uint32_t geometry_type,
+                                                  const shp_shape_t* shape) {
+    if (shape->z != NULL) {
+        geometry_type |= SHP_EWKB_Z_BIT;
+    }
+
+    if (shape->m != NULL) {
+        geometry_type |= SHP_EWKB_M_BIT;
+    }
+
+    dest[0] = SHP_WKB_ENDIAN;
+    return shp_wkb_write_uint32(dest + 1, geometry_type);
+}
+
+static inline unsigned char* shp_wkb_write_coords(unsigned char* dest, const shp_shape_t* shape,
+                                                  uint32_t start, uint32_t end, size_t coord_bytes) {
+    shp_decode_coords(shape, start, end, shape->z != NULL, shape->m != NULL, dest);
+    return dest + coord_bytes * (end - start);
+}
+
+static size_t shp_wkb_size(const shp_shape_t* shape, const shp_decoded_shape_t* decoded,
+                           const shp_decode_buffer_t* buffer) {
+    size_t coord_bytes = sizeof(double) * (2 + (shape->z != NULL) + (shape->m != NULL));
+
+    switch (shape->shape_type) {
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+        return 5 + coord_bytes;
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+        return 9 + (size_t) shape->n_points * (5 + coord_bytes);
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+        return 9 + (size_t) shape->n_parts * 9 + (size_t) shape->n_points * coord_bytes;
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+        return 9 + (size_t) decoded->n_polygons * 9 + (size_t) shape->n_parts * 4 +
+            (size_t) shape->n_points * coord_bytes;
+    case SHP_TYPE_MULTIPATCH: {
+        // every triangle and every group of rings is a polygon
+        const uint32_t* parts = buffer->ints + decoded->parts;
+        const uint32_t* part_types = buffer->ints + decoded->part_types;
+        size_t size = 9;
+        for (uint32_t i = 0; i < shape->n_parts; i++) {
+            uint32_t n_holes = shp_decode_multipatch_n_holes(part_types, shape->n_parts, i);
+            if (n_holes == UINT32_MAX) {
+                uint32_t n_vertices = parts[i + 1] - parts[i];
+                if (n_vertices > 2) {
+                    size += (size_t) (n_vertices - 2) * (9 + 4 + 4 * coord_bytes);
+                }
+            } else {
+                size += 9 + (size_t) (n_holes + 1) * 4 +
+                    (size_t) (parts[i + n_holes + 1] - parts[i]) * coord_bytes;
+                i += n_holes;
+            }
+        }
+
+        return size;
+    }
+    default:
+        Rf_error("Can't export shape type %u", shape->shape_type);
+    }
+}
+
+static uint32_t shp_multipatch_n_polygons(const shp_decoded_shape_t* decoded,
+                                          const shp_decode_buffer_t* buffer) {
+    const uint32_t* parts = buffer->ints + decoded->parts;
+    const uint32_t* part_types = buffer->ints + decoded->part_types;
+    uint32_t n_polygons = 0;
+    for (uint32_t i = 0; i < decoded->n_parts; i++) {
+        uint32_t n_holes = shp_decode_multipatch_n_holes(part_types, decoded->n_parts, i);
+        if (n_holes == UINT32_MAX) {
+            uint32_t n_vertices = parts[i + 1] - parts[i];
+            n_polygons += (n_vertices > 2) ? (n_vertices - 2) : 0;
+        } else {
+            n_polygons++;
+            i += n_holes;
+        }
+    }
+
+    return n_polygons;
+}
+
+static void shp_wkb_write(const shp_shape_t* shape, const shp_decoded_shape_t* decoded,
+                          const shp_decode_buffer_t* buffer, unsigned char* dest) {
+    size_t coord_bytes = sizeof(double) * (2 + (shape->z != NULL) + (shape->m != NULL));
+
+    switch (shape->shape_type) {
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+        dest = shp_wkb_write_header(dest, SHP_WKB_POINT, shape);
+        shp_wkb_write_coords(dest, shape, 0, 1, coord_bytes);
+        return;
+
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+        dest = shp_wkb_write_header(dest, SHP_WKB_MULTIPOINT, shape);
+        dest = shp_wkb_write_uint32(dest, shape->n_points);
+        for (uint32_t i = 0; i < shape->n_points; i++) {
+            dest = shp_wkb_write_header(dest, SHP_WKB_POINT, shape);
+            dest = shp_wkb_write_coords(dest, shape, i, i + 1, coord_bytes);
+        }
+        return;
+
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+        dest = shp_wkb_write_header(dest, SHP_WKB_MULTILINESTRING, shape);
+        dest = shp_wkb_write_uint32(dest, shape->n_parts);
+        for (uint32_t i = 0; i < shape->n_parts; i++) {
+            uint32_t start = shp_le_uint32(shape->parts + i * 4);
+            uint32_t end = (i + 1) < shape->n_parts ?
+                shp_le_uint32(shape->parts + (i + 1) * 4) : shape->n_points;
+            dest = shp_wkb_write_header(dest, SHP_WKB_LINESTRING, shape);
+            dest = shp_wkb_write_uint32(dest, end - start);
+            dest = shp_wkb_write_coords(dest, shape, start, end, coord_bytes);
+        }
+        return;
+
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ: {
+        const uint32_t* parts = buffer->ints + decoded->parts;
+        const uint32_t* rings = buffer->ints + decoded->rings;
+        const uint32_t* polygon_size = buffer->ints + decoded->polygon_size;
+
+        dest = shp_wkb_write_header(dest, SHP_WKB_MULTIPOLYGON, shape);
+        dest = shp_wkb_write_uint32(dest, decoded->n_polygons);
+        for (uint32_t i = 0; i < decoded->n_polygons; i++) {
+            dest = shp_wkb_write_header(dest, SHP_WKB_POLYGON, shape);
+            dest = shp_wkb_write_uint32(dest, polygon_size[i]);
+            for (uint32_t j = 0; j < polygon_size[i]; j++) {
+                uint32_t ring = *rings++;
+                dest = shp_wkb_write_uint32(dest, parts[ring + 1] - parts[ring]);
+                dest = shp_wkb_write_coords(dest, shape, parts[ring], parts[ring + 1], coord_bytes);
+            }
+        }
+        return;
+    }
+
+    case SHP_TYPE_MULTIPATCH: {
+        const uint32_t* parts = buffer->ints + decoded->parts;
+        const uint32_t* part_types = buffer->ints + decoded->part_types;
+
+        dest = shp_wkb_write_header(dest, SHP_WKB_MULTIPOLYGON, shape);
+        dest = shp_wkb_write_uint32(dest, shp_multipatch_n_polygons(decoded, buffer));
+        for (uint32_t i = 0; i < shape->n_parts; i++) {
+            uint32_t start = parts[i];
+            uint32_t end = parts[i + 1];
+            uint32_t n_holes = shp_decode_multipatch_n_holes(part_types, shape->n_parts, i);
+
+            if (n_holes == UINT32_MAX) {
+                for (uint32_t j = start; (j + 2) < end; j++) {
+                    uint32_t first = (part_types[i] == SHP_PART_TRIANGLE_STRIP) ? j : start;
+                    uint32_t vertices[4] = {first, j + 1, j + 2, first};
+                    dest = shp_wkb_write_header(dest, SHP_WKB_POLYGON, shape);
+                    dest = shp_wkb_write_uint32(dest, 1);
+                    dest = shp_wkb_write_uint32(dest, 4);
+                    for (int k = 0; k < 4; k++) {
+                        dest = shp_wkb_write_coords(dest, shape, vertices[k], vertices[k] + 1, coord_bytes);
+                    }
+                }
+
+                continue;
+            }
+
+            dest = shp_wkb_write_header(dest, SHP_WKB_POLYGON, shape);
+            dest = shp_wkb_write_uint32(dest, n_holes + 1);
+            for (uint32_t ring = i; ring <= (i + n_holes); ring++) {
+                dest = shp_wkb_write_uint32(dest, parts[ring + 1] - parts[ring]);
+                dest = shp_wkb_write_coords(dest, shape, parts[ring], parts[ring + 1], coord_bytes);
+            }
+
+            i += n_holes;
+        }
+        return;
+    }
+
+    default:
+        Rf_error("Can't export shape type %u", shape->shape_type);
+    }
+}
+
+static SEXP shp_geometry_wkb_with_cleanup(void* data) {
+    shp_exporter_t* exporter = (shp_exporter_t*) data;
+    shp_exporter_open(exporter);
+
+    int* indices = INTEGER(exporter->shp_geometry);
+    R_xlen_t size = Rf_xlength(exporter->shp_geometry);
+    SEXP result = PROTECT(Rf_allocVector(VECSXP, size));
+
+    shp_shape_t shape;
+    shp_decoded_shape_t decoded;
+    for (R_xlen_t i = 0; i < size; i++) {
+        if ((i + 1) % 1000 == 0) R_CheckUserInterrupt();
+
+        if (indices[i] == NA_INTEGER) {
+            continue;
+        }
+
+        shp_exporter_read(exporter, i, indices[i], &shape, &decoded);
+        if (shape.shape_type == SHP_TYPE_NULL) {
+            continue;
+        }
+
+        size_t wkb_size = shp_wkb_size(&shape, &decoded, &exporter->buffer);
+        SEXP item = PROTECT(Rf_allocVector(RAWSXP, wkb_size));
+        shp_wkb_write(&shape, &decoded, &exporter->buffer, RAW(item));
+        SET_VECTOR_ELT(result, i, item);
+        UNPROTECT(1);
+    }
+
+    UNPROTECT(1);
+    return result;
+}
+
+SEXP shp_c_geometry_wkb(SEXP shp_geometry) {
+    shp_exporter_t exporter;
+    exporter.shp_geometry = shp_geometry;
+    exporter.shp = NULL;
+    shp_decode_buffer_init(&exporter.buffer);
+
+    return R_ExecWithCleanup(
+        &shp_geometry_wkb_with_cleanup,
+        &exporter,
+        &shp_exporter_cleanup,
+        &exporter
+    );
+}
+
+// geoarrow-style buffers: interleaved coordinates and (for nested types)
+// zero-based offsets from the outermost level (features) to the innermost
+// (coordinates). Polygons and multipatches are multipolygons.
+typedef struct {
+    int nesting;
+    int has_z;
+    int has_m;
+    R_xlen_t n_coords;
+    R_xlen_t n_parts;
+    R_xlen_t n_polygons;
+} shp_buffers_size_t;
+
+static int shp_buffers_nesting(uint32_t shape_type) {
+    switch (shape_type) {
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+        return 0;
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+        return 1;
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+        return 2;
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+    case SHP_TYPE_MULTIPATCH:
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+static const char* shp_buffers_geometry_type(int nesting) {
+    switch (nesting) {
+    case 0:
+        return "point";
+    case 1:
+        return "multipoint";
+    case 2:
+        return "multilinestring";
+    default:
+        return "multipolygon";
+    }
+}
+
+// The first pass counts coordinates, parts, and polygons (an upper bound for
+// polygons, whose rings aren't grouped until the second pass) so that every
+// buffer can be allocated once.
+static void shp_buffers_count(shp_exporter_t* exporter, shp_buffers_size_t* counts) {
+    int* indices = INTEGER(exporter->shp_geometry);
+    R_xlen_t size = Rf_xlength(exporter->shp_geometry);
+    uint32_t file_shape_type = exporter->shp->header.shape_type;
+
+    counts->nesting = shp_buffers_nesting(file_shape_type);
+    if (counts->nesting < 0) {
+        Rf_error("Can't export shape type %u", file_shape_type);
+    }
+
+    counts->has_z = shp_shape_type_has_z(file_shape_type);
+    counts->has_m = 0;
+
+    uint64_t n_coords = 0;
+    uint64_t n_parts = 0;
+    uint64_t n_polygons = 0;
+
+    shp_shape_t shape;
+    shp_decoded_shape_t decoded;
+    for (R_xlen_t i = 0; i < size; i++) {
+        if ((i + 1) % 1000 == 0) R_CheckUserInterrupt();
+
+        if (indices[i] == NA_INTEGER) {
+            continue;
+        }
+
+        if (shp_read_shape(exporter->shp, indices[i], &shape) != 0) {
+            Rf_error("[i=%ld] %s", (long) i + 1, exporter->shp->error_buf);
+        }
+
+        if (shape.shape_type == SHP_TYPE_NULL) {
+            continue;
+        }
+
+        if (shape.shape_type != file_shape_type) {
+            Rf_error(
+                "[i=%ld] Can't export shape type %u in a file of shape type %u",
+                (long) i + 1, shape.shape_type, file_shape_type
+            );
+        }
+
+        counts->has_m = counts->has_m || (shape.m != NULL);
+
+        if (shape.shape_type != SHP_TYPE_MULTIPATCH) {
+            n_coords += shape.n_points;
+            n_parts += shape.n_parts;
+            n_polygons += shape.n_parts;
+            continue;
+        }
+
+        // triangles are expanded into polygons with a closed ring
+        shp_exporter_read(exporter, i, indices[i], &shape, &decoded);
+        const uint32_t* parts = exporter->buffer.ints + decoded.parts;
+        const uint32_t* part_types = exporter->buffer.ints + decoded.part_types;
+        for (uint32_t j = 0; j < shape.n_parts; j++) {
+            uint32_t n_holes = shp_decode_multipatch_n_holes(part_types, shape.n_parts, j);
+            if (n_holes == UINT32_MAX) {
+                uint32_t n_vertices = parts[j + 1] - parts[j];
+                uint32_t n_triangles = (n_vertices > 2) ? (n_vertices - 2) : 0;
+                n_coords += 4 * (uint64_t) n_triangles;
+                n_parts += n_triangles;
+                n_polygons += n_triangles;
+            } else {
+                n_coords += parts[j + n_holes + 1] - parts[j];
+                n_parts += n_holes + 1;
+                n_polygons++;
+                j += n_holes;
+            }
+        }
+    }
+
+    // points are written (or left empty) for every feature
+    if (counts->nesting == 0) {
+        n_coords = size;
+    }
+
+    if (n_coords > INT_MAX || n_parts > INT_MAX || n_polygons > INT_MAX) {
+        Rf_error("Can't export more than %d coordinates or parts using 32-bit offsets", INT_MAX);
+    }
+
+    counts->n_coords = n_coords;
+    counts->n_parts = n_parts;
+    counts->n_polygons = n_polygons;
+}
+
+static SEXP shp_geometry_buffers_with_cleanup(void* data) {
+    shp_exporter_t* exporter = (shp_exporter_t*) data;
+    shp_exporter_open(exporter);
+
+    int* indices = INTEGER(exporter->shp_geometry);
+    R_xlen_t size = Rf_xlength(exporter->shp_geometry);
+
+    shp_buffers_size_t counts;
+    shp_buffers_count(exporter, &counts);
+    int nesting = counts.nesting;
+    int has_z = counts.has_z;
+    int has_m = counts.has_m;
+    size_t coord_bytes = sizeof(double) * (2 + has_z + has_m);
+
+    SEXP coords = PROTECT(Rf_allocVector(REALSXP, counts.n_coords * (2 + has_z + has_m)));
+    SEXP validity = PROTECT(Rf_allocVector(LGLSXP, size));
+    SEXP geom_offsets = PROTECT(Rf_allocVector(INTSXP, nesting > 0 ? size + 1 : 0));
+    SEXP polygon_offsets = PROTECT(Rf_allocVector(INTSXP, nesting == 3 ? counts.n_polygons + 1 : 0));
+    SEXP part_offsets = PROTECT(Rf_allocVector(INTSXP, nesting >= 2 ? counts.n_parts + 1 : 0));
+
+    unsigned char* coords_data = (unsigned char*) REAL(coords);
+    int* validity_data = LOGICAL(validity);
+    int* geom_data = INTEGER(geom_offsets);
+    int* polygon_data = INTEGER(polygon_offsets);
+    int* part_data = INTEGER(part_offsets);
+
+    // the number of items written at each level
+    int n_coords = 0;
+    int n_parts = 0;
+    int n_polygons = 0;
+    if (nesting > 0) geom_data[0] = 0;
+    if (nesting == 3) polygon_data[0] = 0;
+    if (nesting >= 2) part_data[0] = 0;
+
+    shp_shape_t shape;
+    shp_decoded_shape_t decoded;
+    for (R_xlen_t i = 0; i < size; i++) {
+        if ((i + 1) % 1000 == 0) R_CheckUserInterrupt();
+
+        int is_null = indices[i] == NA_INTEGER;
+        if (!is_null) {
+            shp_exporter_read(exporter, i, indices[i], &shape, &decoded);
+            is_null = shape.shape_type == SHP_TYPE_NULL;
+        }
+
+        validity_data[i] = !is_null;
+
+        if (nesting == 0) {
+            // null points are written as empty (all NaN) points
+            if (is_null) {
+                double nan_value = R_NaN;
+                for (int j = 0; j < (2 + has_z + has_m); j++) {
+                    memcpy(coords_data + i * coord_bytes + j * sizeof(double), &nan_value, sizeof(double));
+                }
+            } else {
+                shp_decode_coords(&shape, 0, 1, has_z, has_m, coords_data + i * coord_bytes);
+            }
+
+            continue;
+        }
+
+        if (is_null) {
+            geom_data[i + 1] = (nesting == 1) ? n_coords : ((nesting == 2) ? n_parts : n_polygons);
+            continue;
+        }
+
+        switch (nesting) {
+        case 1:
+            shp_decode_coords(&shape, 0, shape.n_points, has_z, has_m, coords_data + n_coords * coord_bytes);
+            n_coords += shape.n_points;
+            geom_data[i + 1] = n_coords;
+            break;
+
+        case 2:
+            for (uint32_t j = 0; j < shape.n_parts; j++) {
+                uint32_t start = shp_le_uint32(shape.parts + j * 4);
+                uint32_t end = (j + 1) < shape.n_parts ?
+                    shp_le_uint32(shape.parts + (j + 1) * 4) : shape.n_points;
+                shp_decode_coords(&shape, start, end, has_z, has_m, coords_data + n_coords * coord_bytes);
+                n_coords += end - start;
+                part_data[++n_parts] = n_coords;
+            }
+            geom_data[i + 1] = n_parts;
+            break;
+
+        default: {
+            const uint32_t* parts = exporter->buffer.ints + decoded.parts;
+
+            if (shape.shape_type != SHP_TYPE_MULTIPATCH) {
+                const uint32_t* rings = exporter->buffer.ints + decoded.rings;
+                const uint32_t* polygon_size = exporter->buffer.ints + decoded.polygon_size;
+                for (uint32_t j = 0; j < decoded.n_polygons; j++) {
+                    for (uint32_t k = 0; k < polygon_size[j]; k++) {
+                        uint32_t ring = *rings++;
+                        shp_decode_coords(
+                            &shape, parts[ring], parts[ring + 1], has_z, has_m,
+                            coords_data + n_coords * coord_bytes
+                        );
+                        n_coords += parts[ring + 1] - parts[ring];
+                        part_data[++n_parts] = n_coords;
+                    }
+                    polygon_data[++n_polygons] = n_parts;
+                }
+
+                geom_data[i + 1] = n_polygons;
+                break;
+            }
+
+            const uint32_t* part_types = exporter->buffer.ints + decoded.part_types;
+            for (uint32_t j = 0; j < shape.n_parts; j++) {
+                uint32_t start = parts[j];
+                uint32_t end = parts[j + 1];
+                uint32_t n_holes = shp_decode_multipatch_n_holes(part_types, shape.n_parts, j);
+
+                if (n_holes == UINT32_MAX) {
+                    for (uint32_t k = start; (k + 2) < end; k++) {
+                        uint32_t first = (part_types[j] == SHP_PART_TRIANGLE_STRIP) ? k : start;
+                        uint32_t vertices[4] = {first, k + 1, k + 2, first};
+                        for (int v = 0; v < 4; v++) {
+                            shp_decode_coords(
+                                &shape, vertices[v], vertices[v] + 1, has_z, has_m,
+                                coords_data + n_coords * coord_bytes
+                            );
+                            n_coords++;
+                        }
+                        part_data[++n_parts] = n_coords;
+                        polygon_data[++n_polygons] = n_parts;
+                    }
+
+                    continue;
+                }
+
+                for (uint32_t ring = j; ring <= (j + n_holes); ring++) {
+                    shp_decode_coords(
+                        &shape, parts[ring], parts[ring + 1], has_z, has_m,
+                        coords_data + n_coords * coord_bytes
+                    );
+                    n_coords += parts[ring + 1] - parts[ring];
+                    part_data[++n_parts] = n_coords;
+                }
+                polygon_data[++n_polygons] = n_parts;
+                j += n_holes;
+            }
+
+            geom_data[i + 1] = n_polygons;
+            break;
+        }
+        }
+    }
+
+    // polygons were counted before their rings were grouped
+    if (nesting == 3 && n_polygons < counts.n_polygons) {
+        polygon_offsets = PROTECT(Rf_xlengthgets(polygon_offsets, n_polygons + 1));
+    } else {
+        PROTECT(polygon_offsets);
+    }
+
+    int n_offsets = (nesting == 3) ? 3 : nesting;
+    SEXP offsets = PROTECT(Rf_allocVector(VECSXP, n_offsets));
+    if (n_offsets > 0) SET_VECTOR_ELT(offsets, 0, geom_offsets);
+    if (nesting == 2) SET_VECTOR_ELT(offsets, 1, part_offsets);
+    if (nesting == 3) {
+        SET_VECTOR_ELT(offsets, 1, polygon_offsets);
+        SET_VECTOR_ELT(offsets, 2, part_offsets);
+    }
+
+    char dims[5] = "xy";
+    if (has_z) strcat(dims, "z");
+    if (has_m) strcat(dims, "m");
+
+    const char* names[] = {"geometry_type", "dims", "coords", "offsets", "validity", ""};
+    SEXP result = PROTECT(Rf_mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(result, 0, Rf_mkString(shp_buffers_geometry_type(nesting)));
+    SET_VECTOR_ELT(result, 1, Rf_mkString(dims));
+    SET_VECTOR_ELT(result, 2, coords);
+    SET_VECTOR_ELT(result, 3, offsets);
+    SET_VECTOR_ELT(result, 4, validity);
+    UNPROTECT(8);
+    return result;
+}
+
+SEXP shp_c_geometry_buffers(SEXP shp_geometry) {
+    shp_exporter_t exporter;
+    exporter.shp_geometry = shp_geometry;
+    exporter.shp = NULL;
+    shp_decode_buffer_init(&exporter.buffer);
+
+    return R_ExecWithCleanup(
+        &shp_geometry_buffers_with_cleanup,
+        &exporter,
+        &shp_exporter_cleanup,
+        &exporter
+    );
+}
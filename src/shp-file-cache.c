@@ -0,0 +1,389 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <R.h>
+#include <Rinternals.h>
+#include "shp-file-cache.h"
+
+// The maximum number of idle handles to keep open. Opening a file
+// with shapelib reads the entire .shx and opening a file with minishp
+// maps or reads the header, which adds up when the same file is opened
+// repeatedly (e.g., when formatting or slicing a geometry vector).
+// Handles that are in use or pinned don't count towards this limit.
+#ifndef SHP_FILE_CACHE_SIZE
+#define SHP_FILE_CACHE_SIZE 8
+#endif
+
+// The modification time in nanoseconds (where available) so that a file
+// rewritten within the same second is detected as changed
+#if defined(__APPLE__)
+#define SHP_STAT_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#elif defined(_WIN32)
+#define SHP_STAT_MTIME_NSEC(st) 0
+#else
+#define SHP_STAT_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+// A file is considered unchanged if it is the same file (device and
+// inode, so that a file replaced by rename() is detected) with the same
+// size and modification time
+typedef struct {
+    int exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+} shp_file_cache_stat_t;
+
+static void shp_file_cache_stat(const char* filename, shp_file_cache_stat_t* file_stat) {
+    struct stat st;
+    memset(file_stat, 0, sizeof(shp_file_cache_stat_t));
+    if (stat(filename, &st) == 0) {
+        file_stat->exists = 1;
+        file_stat->dev = st.st_dev;
+        file_stat->ino = st.st_ino;
+        file_stat->size = st.st_size;
+        file_stat->mtime = st.st_mtime;
+        file_stat->mtime_nsec = SHP_STAT_MTIME_NSEC(st);
+    }
+}
+
+static int shp_file_cache_stat_equal(const shp_file_cache_stat_t* a, const shp_file_cache_stat_t* b) {
+    return a->exists == b->exists &&
+        a->dev == b->dev &&
+        a->ino == b->ino &&
+        a->size == b->size &&
+        a->mtime == b->mtime &&
+        a->mtime_nsec == b->mtime_nsec;
+}
+
+// Both minishp and shapelib keep (part of) the .shx with an open handle,
+// so it is checked as well. This uses the same rule as shp_open_shx() for
+// the .shx filename (.SHP -> .SHX and .shp -> .shx).
+static void shp_file_cache_stat_shx(const char* filename, shp_file_cache_stat_t* file_stat) {
+    size_t filename_len = strlen(filename);
+    char* shx_filename = (char*) malloc(filename_len + 1);
+    if (shx_filename == NULL || filename_len == 0) {
+        free(shx_filename);
+        memset(file_stat, 0, sizeof(shp_file_cache_stat_t));
+        return;
+    }
+
+    memcpy(shx_filename, filename, filename_len + 1);
+    shx_filename[filename_len - 1] = filename[filename_len - 1] == 'P' ? 'X' : 'x';
+    shp_file_cache_stat(shx_filename, file_stat);
+    free(shx_filename);
+}
+
+enum shp_file_cache_kind {
+    SHP_FILE_CACHE_MINISHP = 0,
+    SHP_FILE_CACHE_SHAPELIB = 1
+};
+
+// Entries are kept in a doubly-linked list in most-recently-used order.
+// Entries are only ever accessed from the main R thread. An entry that
+// is stale (because the file changed or it was explicitly invalidated)
+// is never handed out again and is removed as soon as it is neither
+// in use nor pinned.
+typedef struct shp_file_cache_entry_t {
+    char* filename;
+    int kind;
+    shp_file_cache_stat_t shp_stat;
+    shp_file_cache_stat_t shx_stat;
+    shp_file_t* shp;
+    SHPHandle hSHP;
+    int in_use;
+    int n_pins;
+    int stale;
+    struct shp_file_cache_entry_t* prev;
+    struct shp_file_cache_entry_t* next;
+} shp_file_cache_entry_t;
+
+static shp_file_cache_entry_t* shp_file_cache_head = NULL;
+
+static void shp_file_cache_unlink(shp_file_cache_entry_t* entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        shp_file_cache_head = entry->next;
+    }
+
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void shp_file_cache_push_front(shp_file_cache_entry_t* entry) {
+    entry->prev = NULL;
+    entry->next = shp_file_cache_head;
+    if (shp_file_cache_head != NULL) {
+        shp_file_cache_head->prev = entry;
+    }
+
+    shp_file_cache_head = entry;
+}
+
+static void shp_file_cache_remove(shp_file_cache_entry_t* entry) {
+    shp_file_cache_unlink(entry);
+
+    if (entry->shp != NULL) {
+        shp_close(entry->shp);
+    }
+
+    if (entry->hSHP != NULL) {
+        SHPClose(entry->hSHP);
+    }
+
+    free(entry->filename);
+    free(entry);
+}
+
+static int shp_file_cache_is_idle(shp_file_cache_entry_t* entry) {
+    return !entry->in_use && entry->n_pins == 0;
+}
+
+static void shp_file_cache_remove_if_idle(shp_file_cache_entry_t* entry) {
+    if (shp_file_cache_is_idle(entry) && (entry->stale || SHP_FILE_CACHE_SIZE == 0)) {
+        shp_file_cache_remove(entry);
+    }
+}
+
+// Close the least recently used idle handles beyond SHP_FILE_CACHE_SIZE
+static void shp_file_cache_evict(void) {
+    int n_idle = 0;
+    shp_file_cache_entry_t* entry = shp_file_cache_head;
+    shp_file_cache_entry_t* next;
+    while (entry != NULL) {
+        next = entry->next;
+        if (shp_file_cache_is_idle(entry)) {
+            n_idle++;
+            if (n_idle > SHP_FILE_CACHE_SIZE) {
+                shp_file_cache_remove(entry);
+            }
+        }
+
+        entry = next;
+    }
+}
+
+static shp_file_cache_entry_t* shp_file_cache_find_handle(void* handle) {
+    for (shp_file_cache_entry_t* entry = shp_file_cache_head; entry != NULL; entry = entry->next) {
+        if (entry->shp == handle || entry->hSHP == handle) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Find (or open and insert) a valid entry for filename. Returns NULL if
+// the file can't be stat()ed or opened, in which case the caller should
+// open an uncached handle to get a useful error message.
+static shp_file_cache_entry_t* shp_file_cache_entry(const char* filename, int kind) {
+    shp_file_cache_stat_t shp_stat;
+    shp_file_cache_stat(filename, &shp_stat);
+    if (!shp_stat.exists) {
+        return NULL;
+    }
+
+    shp_file_cache_stat_t shx_stat;
+    shp_file_cache_stat_shx(filename, &shx_stat);
+
+    shp_file_cache_entry_t* entry;
+    for (entry = shp_file_cache_head; entry != NULL; entry = entry->next) {
+        if (entry->stale || entry->kind != kind || strcmp(entry->filename, filename) != 0) {
+            continue;
+        }
+
+        if (shp_file_cache_stat_equal(&entry->shp_stat, &shp_stat) &&
+                shp_file_cache_stat_equal(&entry->shx_stat, &shx_stat)) {
+            shp_file_cache_unlink(entry);
+            shp_file_cache_push_front(entry);
+            return entry;
+        }
+
+        // The .shp or .shx has changed since it was opened
+        entry->stale = 1;
+        shp_file_cache_remove_if_idle(entry);
+        break;
+    }
+
+    shp_file_t* shp = NULL;
+    SHPHandle hSHP = NULL;
+    if (kind == SHP_FILE_CACHE_MINISHP) {
+        shp = shp_open(filename);
+        if (!shp_valid(shp)) {
+            shp_close(shp);
+            return NULL;
+        }
+    } else {
+        hSHP = SHPOpen(filename, "rb");
+        if (hSHP == NULL) {
+            return NULL;
+        }
+    }
+
+    entry = (shp_file_cache_entry_t*) malloc(sizeof(shp_file_cache_entry_t));
+    char* filename_copy = (char*) malloc(strlen(filename) + 1);
+    if (entry == NULL || filename_copy == NULL) {
+        free(entry);
+        free(filename_copy);
+        if (shp != NULL) shp_close(shp);
+        if (hSHP != NULL) SHPClose(hSHP);
+        return NULL;
+    }
+
+    strcpy(filename_copy, filename);
+    entry->filename = filename_copy;
+    entry->kind = kind;
+    entry->shp_stat = shp_stat;
+    entry->shx_stat = shx_stat;
+    entry->shp = shp;
+    entry->hSHP = hSHP;
+    entry->in_use = 0;
+    entry->n_pins = 0;
+    entry->stale = 0;
+    shp_file_cache_push_front(entry);
+    return entry;
+}
+
+shp_file_t* shp_file_cache_acquire(const char* filename) {
+    shp_file_cache_entry_t* entry = shp_file_cache_entry(filename, SHP_FILE_CACHE_MINISHP);
+    if (entry == NULL || entry->in_use) {
+        return shp_open(filename);
+    }
+
+    entry->in_use = 1;
+    return entry->shp;
+}
+
+void shp_file_cache_release(shp_file_t* shp) {
+    if (shp == NULL) {
+        return;
+    }
+
+    shp_file_cache_entry_t* entry = shp_file_cache_find_handle(shp);
+    if (entry == NULL) {
+        shp_close(shp);
+        return;
+    }
+
+    entry->in_use = 0;
+    shp_file_cache_remove_if_idle(entry);
+    shp_file_cache_evict();
+}
+
+SHPHandle shp_file_cache_acquire_shapelib(const char* filename) {
+    shp_file_cache_entry_t* entry = shp_file_cache_entry(filename, SHP_FILE_CACHE_SHAPELIB);
+    if (entry == NULL || entry->in_use) {
+        return SHPOpen(filename, "rb");
+    }
+
+    entry->in_use = 1;
+    return entry->hSHP;
+}
+
+void shp_file_cache_release_shapelib(SHPHandle hSHP) {
+    if (hSHP == NULL) {
+        return;
+    }
+
+    shp_file_cache_entry_t* entry = shp_file_cache_find_handle(hSHP);
+    if (entry == NULL) {
+        SHPClose(hSHP);
+        return;
+    }
+
+    entry->in_use = 0;
+    shp_file_cache_remove_if_idle(entry);
+    shp_file_cache_evict();
+}
+
+void shp_file_cache_invalidate(const char* filename) {
+    shp_file_cache_stat_t shp_stat;
+    int has_stat = 0;
+    if (filename != NULL) {
+        shp_file_cache_stat(filename, &shp_stat);
+        has_stat = shp_stat.exists && shp_stat.ino != 0;
+    }
+
+    shp_file_cache_entry_t* entry = shp_file_cache_head;
+    shp_file_cache_entry_t* next;
+    while (entry != NULL) {
+        next = entry->next;
+        if (filename == NULL ||
+            strcmp(entry->filename, filename) == 0 ||
+            (has_stat && entry->shp_stat.dev == shp_stat.dev && entry->shp_stat.ino == shp_stat.ino)) {
+            entry->stale = 1;
+            shp_file_cache_remove_if_idle(entry);
+        }
+
+        entry = next;
+    }
+}
+
+SEXP shp_c_file_cache_invalidate(SEXP filename_sexp) {
+    if (filename_sexp == R_NilValue) {
+        shp_file_cache_invalidate(NULL);
+        return R_NilValue;
+    }
+
+    for (R_xlen_t i = 0; i < Rf_xlength(filename_sexp); i++) {
+        if (STRING_ELT(filename_sexp, i) != NA_STRING) {
+            shp_file_cache_invalidate(Rf_translateCharUTF8(STRING_ELT(filename_sexp, i)));
+        }
+    }
+
+    return R_NilValue;
+}
+
+static void shp_file_pin_finalize(SEXP pin_xptr) {
+    shp_file_cache_entry_t* entry = (shp_file_cache_entry_t*) R_ExternalPtrAddr(pin_xptr);
+    if (entry != NULL) {
+        R_ClearExternalPtr(pin_xptr);
+        entry->n_pins--;
+        shp_file_cache_remove_if_idle(entry);
+        shp_file_cache_evict();
+    }
+}
+
+// Pinning keeps a cached handle open regardless of SHP_FILE_CACHE_SIZE
+// (e.g., for the duration of read_shp_chunked()).
+SEXP shp_c_file_pin(SEXP filename_sexp) {
+    const char* filename = Rf_translateCharUTF8(STRING_ELT(filename_sexp, 0));
+
+    // allocate the external pointer before touching the cache
+    // as this allocation may fail
+    SEXP pin_xptr = PROTECT(R_MakeExternalPtr(NULL, R_NilValue, filename_sexp));
+    R_RegisterCFinalizer(pin_xptr, &shp_file_pin_finalize);
+
+    shp_file_cache_entry_t* entry = shp_file_cache_entry(filename, SHP_FILE_CACHE_MINISHP);
+    if (entry == NULL) {
+        shp_file_t* shp = shp_open(filename);
+        char error_buf[SHP_ERROR_SIZE];
+        memcpy(error_buf, shp->error_buf, sizeof(error_buf));
+        error_buf[sizeof(error_buf) - 1] = '\0';
+        shp_close(shp);
+        if (error_buf[0] == '\0') {
+            Rf_error("Failed to open shp file '%s'", filename);
+        } else {
+            Rf_error("%s", error_buf);
+        }
+    }
+
+    entry->n_pins++;
+    R_SetExternalPtrAddr(pin_xptr, entry);
+    UNPROTECT(1);
+    return pin_xptr;
+}
+
+SEXP shp_c_file_unpin(SEXP pin_xptr) {
+    shp_file_pin_finalize(pin_xptr);
+    return R_NilValue;
+}
@@ -0,0 +1,24 @@
+
+#ifndef SHP_FILE_CACHE_H
+#define SHP_FILE_CACHE_H
+
+#include "shapefil.h"
+#include "minishp-shp.h"
+
+// A process-level cache of open .shp handles keyed by filename and the
+// identity (device and inode), modification time, and size of the .shp
+// and .shx. Handles returned by the acquire
+// functions must be passed to the matching release function when they
+// are no longer needed (even if they aren't valid). A handle that is
+// currently acquired is never handed out twice: a nested acquire of the
+// same file opens a new (uncached) handle.
+shp_file_t* shp_file_cache_acquire(const char* filename);
+void shp_file_cache_release(shp_file_t* shp);
+SHPHandle shp_file_cache_acquire_shapelib(const char* filename);
+void shp_file_cache_release_shapelib(SHPHandle hSHP);
+
+// Closes (or marks for closing) cached handles for filename, or all
+// cached handles if filename is NULL.
+void shp_file_cache_invalidate(const char* filename);
+
+#endif
@@ -3,99 +3,493 @@
 #include <R.h>
 #include <Rinternals.h>
 #include "minishp-shp.h"
+#include "shp-file-cache.h"
+#include "shp-decode.h"
 #include "wk-v1.h"
+#include "shp-coord-span.h"
 
 #define HANDLE_CONTINUE_OR_BREAK(expr)                           \
     result = expr;                                               \
     if (result == WK_ABORT_FEATURE) continue; else if (result == WK_ABORT) break
 
+#define HANDLE_OR_RETURN(expr)                                   \
+    result = expr;                                               \
+    if (result != WK_CONTINUE) return result
+
+// Decoding features on worker threads only pays off when there are
+// at least a few batches of them
+#ifndef SHP_DECODE_MIN_FEATURES
+#define SHP_DECODE_MIN_FEATURES 4096
+#endif
+
+// Span callbacks (see shp-coord-span.h) registered by handlers that can
+// accept all the coordinates of a linestring or ring at once
+#define SHP_COORD_SPAN_MAX_HANDLERS 32
+
+typedef struct {
+    shp_coord_fn_t coord;
+    shp_coord_span_fn_t coord_span;
+} shp_coord_span_entry_t;
+
+static shp_coord_span_entry_t shp_coord_span_handlers[SHP_COORD_SPAN_MAX_HANDLERS];
+static int shp_n_coord_span_handlers = 0;
+
+// Registered as a C callable (see shp_init_c_callables())
+int shp_register_coord_span(shp_coord_fn_t coord, shp_coord_span_fn_t coord_span) {
+    for (int i = 0; i < shp_n_coord_span_handlers; i++) {
+        if (shp_coord_span_handlers[i].coord != coord) {
+            continue;
+        }
+
+        if (coord_span != NULL) {
+            shp_coord_span_handlers[i].coord_span = coord_span;
+        } else {
+            shp_n_coord_span_handlers--;
+            shp_coord_span_handlers[i] = shp_coord_span_handlers[shp_n_coord_span_handlers];
+        }
+
+        return 0;
+    }
+
+    if (coord_span == NULL) {
+        return 0;
+    } else if (shp_n_coord_span_handlers == SHP_COORD_SPAN_MAX_HANDLERS) {
+        return 1;
+    }
+
+    shp_coord_span_handlers[shp_n_coord_span_handlers].coord = coord;
+    shp_coord_span_handlers[shp_n_coord_span_handlers].coord_span = coord_span;
+    shp_n_coord_span_handlers++;
+    return 0;
+}
+
+shp_coord_span_fn_t shp_coord_span_lookup(shp_coord_fn_t coord) {
+    for (int i = 0; i < shp_n_coord_span_handlers; i++) {
+        if (shp_coord_span_handlers[i].coord == coord) {
+            return shp_coord_span_handlers[i].coord_span;
+        }
+    }
+
+    return NULL;
+}
+
 typedef struct {
   SEXP shp_geometry;
+  int num_threads;
   shp_file_t* shp;
   wk_handler_t* handler;
+  // NULL if the handler only accepts one coordinate at a time
+  shp_coord_span_fn_t coord_span;
+  // decoded shapes for single-threaded reading
+  shp_decode_buffer_t buffer;
+  shp_decoder_t* decoder;
 } shp_reader_t;
 
-void shp_handle_geometry_point(shp_reader_t* reader, const wk_vector_meta_t* vector_meta) {
+void shp_meta_init(wk_meta_t* meta, const shp_decoded_shape_t* shape, uint32_t geometry_type, uint32_t size) {
+    WK_META_RESET((*meta), geometry_type);
+    meta->size = size;
+    if (shape->has_z) {
+        meta->flags |= WK_FLAG_HAS_Z;
+    }
+    if (shape->has_m) {
+        meta->flags |= WK_FLAG_HAS_M;
+    }
+}
+
+// Shapes are handled from their decoded coordinates and part boundaries
+// (see shp_decode_shape()), which may have been decoded on another thread
+typedef struct {
+    const shp_decoded_shape_t* shape;
+    const double* coords;
+    const uint32_t* parts;
+    const uint32_t* part_types;
+    const uint32_t* rings;
+    const uint32_t* polygon_size;
+} shp_shape_view_t;
+
+static inline void shp_shape_view_init(shp_shape_view_t* view, const shp_decoded_shape_t* shape,
+                                       const shp_decode_buffer_t* buffer) {
+    view->shape = shape;
+    view->coords = buffer->coords + shape->coords;
+    view->parts = buffer->ints + shape->parts;
+    view->part_types = buffer->ints + shape->part_types;
+    view->rings = buffer->ints + shape->rings;
+    view->polygon_size = buffer->ints + shape->polygon_size;
+}
+
+static inline const double* shp_view_coord(const shp_shape_view_t* view, uint32_t i) {
+    return view->coords + i * view->shape->coord_size;
+}
+
+int shp_handle_coords(shp_reader_t* reader, const wk_meta_t* meta, const shp_shape_view_t* view,
+                      uint32_t start, uint32_t end) {
     wk_handler_t* handler = reader->handler;
     int result;
 
-    int* indices = INTEGER(reader->shp_geometry);
-    uint32_t size = Rf_length(reader->shp_geometry);
+    // decoded coordinates for a part are contiguous
+    if (reader->coord_span != NULL) {
+        return reader->coord_span(meta, shp_view_coord(view, start), end - start,
+                                  view->shape->coord_size, 0, handler->handler_data);
+    }
+
+    const double* coord = shp_view_coord(view, start);
+    uint32_t stride = view->shape->coord_size;
+    for (uint32_t i = start; i < end; i++) {
+        HANDLE_OR_RETURN(handler->coord(meta, coord, i - start, handler->handler_data));
+        coord += stride;
+    }
+
+    return WK_CONTINUE;
+}
+
+int shp_handle_point(shp_reader_t* reader, const shp_shape_view_t* view, uint32_t part_id) {
+    wk_handler_t* handler = reader->handler;
+    int result;
 
-    // purely for proof-of-concept with one file type
     wk_meta_t meta;
-    WK_META_RESET(meta, WK_POINT);
-    meta.flags |= WK_FLAG_HAS_Z;
-    meta.size = 1;
+    shp_meta_init(&meta, view->shape, WK_POINT, 1);
 
-    int record_buffer_size = 64;
-    shp_shape_pointz_record_t records[64];
-    uint32_t record_start = UINT32_MAX;
-    uint32_t record_end = UINT32_MAX;
+    HANDLE_OR_RETURN(handler->geometry_start(&meta, part_id, handler->handler_data));
+    HANDLE_OR_RETURN(shp_handle_coords(reader, &meta, view, 0, 1));
+    return handler->geometry_end(&meta, part_id, handler->handler_data);
+}
 
-    double coord[4];
-    uint32_t shape_id;
-    size_t n_read;
-    shp_shape_pointz_record_t record;
+int shp_handle_multipoint(shp_reader_t* reader, const shp_shape_view_t* view, uint32_t part_id) {
+    wk_handler_t* handler = reader->handler;
+    int result;
 
-    for (int i = 0; i < size; i++) {
-        HANDLE_CONTINUE_OR_BREAK(handler->feature_start(vector_meta, i, handler->handler_data));
+    wk_meta_t meta;
+    shp_meta_init(&meta, view->shape, WK_MULTIPOINT, view->shape->n_points);
+    wk_meta_t meta_point;
+    shp_meta_init(&meta_point, view->shape, WK_POINT, 1);
+
+    HANDLE_OR_RETURN(handler->geometry_start(&meta, part_id, handler->handler_data));
+    for (uint32_t i = 0; i < view->shape->n_points; i++) {
+        HANDLE_OR_RETURN(handler->geometry_start(&meta_point, i, handler->handler_data));
+        HANDLE_OR_RETURN(shp_handle_coords(reader, &meta_point, view, i, i + 1));
+        HANDLE_OR_RETURN(handler->geometry_end(&meta_point, i, handler->handler_data));
+    }
+
+    return handler->geometry_end(&meta, part_id, handler->handler_data);
+}
+
+int shp_handle_polyline(shp_reader_t* reader, const shp_shape_view_t* view, uint32_t part_id) {
+    wk_handler_t* handler = reader->handler;
+    int result;
+
+    wk_meta_t meta;
+    shp_meta_init(&meta, view->shape, WK_MULTILINESTRING, view->shape->n_parts);
+    wk_meta_t meta_linestring;
+    shp_meta_init(&meta_linestring, view->shape, WK_LINESTRING, 0);
+
+    HANDLE_OR_RETURN(handler->geometry_start(&meta, part_id, handler->handler_data));
+    for (uint32_t i = 0; i < view->shape->n_parts; i++) {
+        uint32_t start = view->parts[i];
+        uint32_t end = view->parts[i + 1];
+        meta_linestring.size = end - start;
+
+        HANDLE_OR_RETURN(handler->geometry_start(&meta_linestring, i, handler->handler_data));
+        HANDLE_OR_RETURN(shp_handle_coords(reader, &meta_linestring, view, start, end));
+        HANDLE_OR_RETURN(handler->geometry_end(&meta_linestring, i, handler->handler_data));
+    }
+
+    return handler->geometry_end(&meta, part_id, handler->handler_data);
+}
+
+// Rings were grouped into polygons when the shape was decoded
+int shp_handle_polygon(shp_reader_t* reader, const shp_shape_view_t* view, uint32_t part_id) {
+    wk_handler_t* handler = reader->handler;
+    int result;
+
+    wk_meta_t meta;
+    shp_meta_init(&meta, view->shape, WK_MULTIPOLYGON, view->shape->n_polygons);
+    wk_meta_t meta_polygon;
+    shp_meta_init(&meta_polygon, view->shape, WK_POLYGON, 0);
+
+    HANDLE_OR_RETURN(handler->geometry_start(&meta, part_id, handler->handler_data));
+    const uint32_t* rings = view->rings;
+    for (uint32_t i = 0; i < view->shape->n_polygons; i++) {
+        meta_polygon.size = view->polygon_size[i];
+        HANDLE_OR_RETURN(handler->geometry_start(&meta_polygon, i, handler->handler_data));
+
+        for (uint32_t ring_id = 0; ring_id < view->polygon_size[i]; ring_id++) {
+            uint32_t ring = *rings++;
+            uint32_t start = view->parts[ring];
+            uint32_t end = view->parts[ring + 1];
+            HANDLE_OR_RETURN(handler->ring_start(&meta_polygon, end - start, ring_id, handler->handler_data));
+            HANDLE_OR_RETURN(shp_handle_coords(reader, &meta_polygon, view, start, end));
+            HANDLE_OR_RETURN(handler->ring_end(&meta_polygon, end - start, ring_id, handler->handler_data));
+        }
+
+        HANDLE_OR_RETURN(handler->geometry_end(&meta_polygon, i, handler->handler_data));
+    }
+
+    return handler->geometry_end(&meta, part_id, handler->handler_data);
+}
 
-        shape_id = indices[i];
+int shp_handle_triangle(shp_reader_t* reader, const shp_shape_view_t* view, const wk_meta_t* meta,
+                        uint32_t part_id, uint32_t a, uint32_t b, uint32_t c) {
+    wk_handler_t* handler = reader->handler;
+    int result;
+    uint32_t vertices[4] = {a, b, c, a};
+
+    HANDLE_OR_RETURN(handler->geometry_start(meta, part_id, handler->handler_data));
+    HANDLE_OR_RETURN(handler->ring_start(meta, 4, 0, handler->handler_data));
+    if (reader->coord_span != NULL) {
+        uint32_t coord_size = view->shape->coord_size;
+        double ring[16];
+        for (uint32_t i = 0; i < 4; i++) {
+            memcpy(ring + i * coord_size, shp_view_coord(view, vertices[i]), coord_size * sizeof(double));
+        }
+        HANDLE_OR_RETURN(reader->coord_span(meta, ring, 4, coord_size, 0, handler->handler_data));
+    } else {
+        for (uint32_t i = 0; i < 4; i++) {
+            HANDLE_OR_RETURN(handler->coord(meta, shp_view_coord(view, vertices[i]), i, handler->handler_data));
+        }
+    }
+    HANDLE_OR_RETURN(handler->ring_end(meta, 4, 0, handler->handler_data));
+    return handler->geometry_end(meta, part_id, handler->handler_data);
+}
+
+// MultiPatch parts are triangle strips, triangle fans, or rings. Here
+// we represent every triangle and every group of rings as a polygon.
+int shp_handle_multipatch(shp_reader_t* reader, const shp_shape_view_t* view, uint32_t part_id) {
+    wk_handler_t* handler = reader->handler;
+    int result;
+    uint32_t n_parts = view->shape->n_parts;
 
-        if ((shape_id >= record_end) || (shape_id < record_start)) {
-            n_read = shp_read_pointz_record(reader->shp, records, record_buffer_size);
-            if (n_read == 0) {
-                // technically we should check if it stopped at a NULL record
-                Rf_error("Read zero pointz records (start = %d)", shape_id);
+    uint32_t n_polygons = 0;
+    for (uint32_t i = 0; i < n_parts; i++) {
+        uint32_t n_holes = shp_decode_multipatch_n_holes(view->part_types, n_parts, i);
+        if (n_holes == UINT32_MAX) {
+            uint32_t n_vertices = view->parts[i + 1] - view->parts[i];
+            n_polygons += (n_vertices > 2) ? (n_vertices - 2) : 0;
+        } else {
+            n_polygons++;
+            i += n_holes;
+        }
+    }
+
+    wk_meta_t meta;
+    shp_meta_init(&meta, view->shape, WK_MULTIPOLYGON, n_polygons);
+    wk_meta_t meta_polygon;
+    shp_meta_init(&meta_polygon, view->shape, WK_POLYGON, 0);
+
+    HANDLE_OR_RETURN(handler->geometry_start(&meta, part_id, handler->handler_data));
+
+    uint32_t polygon_id = 0;
+    for (uint32_t i = 0; i < n_parts; i++) {
+        uint32_t start = view->parts[i];
+        uint32_t end = view->parts[i + 1];
+        uint32_t part_type = view->part_types[i];
+        uint32_t n_holes = shp_decode_multipatch_n_holes(view->part_types, n_parts, i);
+
+        if (n_holes == UINT32_MAX) {
+            meta_polygon.size = 1;
+            for (uint32_t j = start; (j + 2) < end; j++) {
+                if (part_type == SHP_PART_TRIANGLE_STRIP) {
+                    HANDLE_OR_RETURN(shp_handle_triangle(reader, view, &meta_polygon, polygon_id, j, j + 1, j + 2));
+                } else {
+                    HANDLE_OR_RETURN(shp_handle_triangle(reader, view, &meta_polygon, polygon_id, start, j + 1, j + 2));
+                }
+                polygon_id++;
             }
 
-            record_start = shape_id;
-            record_end = shape_id + n_read;
+            continue;
+        }
+
+        meta_polygon.size = n_holes + 1;
+        HANDLE_OR_RETURN(handler->geometry_start(&meta_polygon, polygon_id, handler->handler_data));
+        for (uint32_t ring_id = 0; ring_id <= n_holes; ring_id++) {
+            start = view->parts[i + ring_id];
+            end = view->parts[i + ring_id + 1];
+            HANDLE_OR_RETURN(handler->ring_start(&meta_polygon, end - start, ring_id, handler->handler_data));
+            HANDLE_OR_RETURN(shp_handle_coords(reader, &meta_polygon, view, start, end));
+            HANDLE_OR_RETURN(handler->ring_end(&meta_polygon, end - start, ring_id, handler->handler_data));
         }
+        HANDLE_OR_RETURN(handler->geometry_end(&meta_polygon, polygon_id, handler->handler_data));
+
+        polygon_id++;
+        i += n_holes;
+    }
+
+    return handler->geometry_end(&meta, part_id, handler->handler_data);
+}
+
+int shp_handle_shape(shp_reader_t* reader, const shp_decoded_shape_t* shape,
+                     const shp_decode_buffer_t* buffer) {
+    shp_shape_view_t view;
+    shp_shape_view_init(&view, shape, buffer);
+
+    switch (shape->shape_type) {
+    case SHP_TYPE_NULL:
+        return reader->handler->null_feature(reader->handler->handler_data);
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+        return shp_handle_point(reader, &view, WK_PART_ID_NONE);
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+        return shp_handle_multipoint(reader, &view, WK_PART_ID_NONE);
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+        return shp_handle_polyline(reader, &view, WK_PART_ID_NONE);
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+        return shp_handle_polygon(reader, &view, WK_PART_ID_NONE);
+    case SHP_TYPE_MULTIPATCH:
+        return shp_handle_multipatch(reader, &view, WK_PART_ID_NONE);
+    default:
+        Rf_error("Can't handle shape type %u", shape->shape_type);
+    }
+}
+
+void shp_vector_meta_init(wk_vector_meta_t* vector_meta, uint32_t shape_type) {
+    switch (shape_type) {
+    case SHP_TYPE_POINT:
+    case SHP_TYPE_POINTM:
+    case SHP_TYPE_POINTZ:
+        WK_VECTOR_META_RESET((*vector_meta), WK_POINT);
+        break;
+    case SHP_TYPE_MULTIPOINT:
+    case SHP_TYPE_MULTIPOINTM:
+    case SHP_TYPE_MULTIPOINTZ:
+        WK_VECTOR_META_RESET((*vector_meta), WK_MULTIPOINT);
+        break;
+    case SHP_TYPE_POLYLINE:
+    case SHP_TYPE_POLYLINEM:
+    case SHP_TYPE_POLYLINEZ:
+        WK_VECTOR_META_RESET((*vector_meta), WK_MULTILINESTRING);
+        break;
+    case SHP_TYPE_POLYGON:
+    case SHP_TYPE_POLYGONM:
+    case SHP_TYPE_POLYGONZ:
+    case SHP_TYPE_MULTIPATCH:
+        WK_VECTOR_META_RESET((*vector_meta), WK_MULTIPOLYGON);
+        break;
+    default:
+        WK_VECTOR_META_RESET((*vector_meta), WK_GEOMETRY);
+        break;
+    }
 
-        record = records[shape_id - record_start];
-        memcpy(coord, record.coords, sizeof(double) * 4);
+    // measures are optional for Z shapes, so we can't know the dimensions
+    // without reading every record
+    if (shp_shape_type_has_z(shape_type)) {
+        vector_meta->flags |= WK_FLAG_HAS_Z | WK_FLAG_DIMS_UNKNOWN;
+    } else if (shp_shape_type_has_m(shape_type)) {
+        vector_meta->flags |= WK_FLAG_HAS_M;
+    }
+}
+
+void shp_handle_geometry_features(shp_reader_t* reader, const wk_vector_meta_t* vector_meta) {
+    wk_handler_t* handler = reader->handler;
+    int result;
+
+    int* indices = INTEGER(reader->shp_geometry);
+    R_xlen_t size = Rf_xlength(reader->shp_geometry);
+    shp_shape_t shape;
+    shp_decoded_shape_t decoded;
+
+    for (R_xlen_t i = 0; i < size; i++) {
+        if ((i + 1) % 1000 == 0) R_CheckUserInterrupt();
+
+        HANDLE_CONTINUE_OR_BREAK(handler->feature_start(vector_meta, i, handler->handler_data));
 
-        HANDLE_CONTINUE_OR_BREAK(handler->geometry_start(&meta, WK_PART_ID_NONE, handler->handler_data));
-        HANDLE_CONTINUE_OR_BREAK(handler->coord(&meta, coord, 0, handler->handler_data));
-        HANDLE_CONTINUE_OR_BREAK(handler->geometry_end(&meta, WK_PART_ID_NONE, handler->handler_data));
+        if (indices[i] == NA_INTEGER) {
+            HANDLE_CONTINUE_OR_BREAK(handler->null_feature(handler->handler_data));
+        } else {
+            if (shp_read_shape(reader->shp, indices[i], &shape) != 0) {
+                Rf_error("[i=%ld] %s", (long) i + 1, reader->shp->error_buf);
+            }
+
+            shp_decode_buffer_reset(&reader->buffer);
+            if (shp_decode_shape(&shape, &reader->buffer, &decoded, reader->shp->error_buf) != 0) {
+                Rf_error("[i=%ld] %s", (long) i + 1, reader->shp->error_buf);
+            }
+
+            HANDLE_CONTINUE_OR_BREAK(shp_handle_shape(reader, &decoded, &reader->buffer));
+        }
 
         HANDLE_CONTINUE_OR_BREAK(handler->feature_end(vector_meta, i, handler->handler_data));
     }
 }
 
+// Worker threads read and decode batches of features (including grouping
+// polygon rings, which is the expensive part for polygons) while this
+// thread passes the batches that are ready to the handler in order. Only
+// this thread calls the handler or the R API.
+void shp_handle_geometry_features_decoded(shp_reader_t* reader, const wk_vector_meta_t* vector_meta) {
+    wk_handler_t* handler = reader->handler;
+    int result = WK_CONTINUE;
+
+    const shp_decoded_batch_t* batch;
+    while ((result != WK_ABORT) && (batch = shp_decoder_next(reader->decoder)) != NULL) {
+        R_CheckUserInterrupt();
+
+        for (int64_t j = 0; j < batch->size; j++) {
+            R_xlen_t i = batch->start + j;
+            HANDLE_CONTINUE_OR_BREAK(handler->feature_start(vector_meta, i, handler->handler_data));
+            HANDLE_CONTINUE_OR_BREAK(shp_handle_shape(reader, batch->shapes + j, batch->buffer));
+            HANDLE_CONTINUE_OR_BREAK(handler->feature_end(vector_meta, i, handler->handler_data));
+        }
+
+        if ((result != WK_ABORT) && (batch->error_i >= 0)) {
+            Rf_error("[i=%ld] %s", (long) batch->error_i + 1, batch->error_buf);
+        }
+    }
+}
+
 SEXP shp_handle_geometry_with_cleanup(void* data) {
     shp_reader_t* reader = (shp_reader_t*) data;
     if (reader->handler->api_version != 1) {
         Rf_error("Can't run a wk_handler with api_version '%d'", reader->handler->api_version);
     }
     reader->handler->initialize(&(reader->handler->dirty), reader->handler->handler_data);
+    reader->coord_span = shp_coord_span_lookup(reader->handler->coord);
 
     // Open the file
     SEXP shp_file = Rf_getAttrib(reader->shp_geometry, Rf_install("file"));
     const char* filename = Rf_translateCharUTF8(STRING_ELT(shp_file, 0));
-    reader->shp = shp_open(filename);
+    reader->shp = shp_file_cache_acquire(filename);
     if (!shp_valid(reader->shp)) {
-        Rf_error(reader->shp->error_buf);
+        Rf_error("%s", reader->shp->error_buf);
+    }
+
+    // When reading a large share of the features, load the whole .shx so
+    // that looking up each shape is an array index (the table stays loaded
+    // with the cached handle). Otherwise (or if this fails), the .shx is
+    // read as needed through its read-ahead and page caches.
+    R_xlen_t size = Rf_xlength(reader->shp_geometry);
+    int use_threads = (reader->num_threads > 1) && (size >= SHP_DECODE_MIN_FEATURES);
+    shx_file_t* shx = shp_open_shx(reader->shp);
+    shx_load_if_dense(shx, use_threads ? shx_n_records(shx) : (uint64_t) size);
+
+    // Worker threads can only read shapes from a memory-mapped file
+    // with a loaded .shx (otherwise, features are decoded on this thread)
+    if (use_threads && (reader->shp->file.fdata != NULL) && shx_valid(shx) && (shx->table != NULL)) {
+        reader->decoder = shp_decoder_start(
+            reader->shp,
+            INTEGER(reader->shp_geometry),
+            size,
+            reader->num_threads
+        );
     }
 
     wk_vector_meta_t vector_meta;
-    WK_VECTOR_META_RESET(vector_meta, WK_POINT);
-    vector_meta.size = Rf_length(reader->shp_geometry);
-    
+    shp_vector_meta_init(&vector_meta, reader->shp->header.shape_type);
+    vector_meta.size = size;
+
     int result;
     result = reader->handler->vector_start(&vector_meta, reader->handler->handler_data);
-    if (result == WK_ABORT) {
-        return reader->handler->vector_end(&vector_meta, reader->handler->handler_data);
-    }
-
-    switch (vector_meta.geometry_type) {
-    case WK_POINT:
-        shp_handle_geometry_point(reader, &vector_meta);
-        break;
-    default:
-        Rf_error("Can't handle geometry type '%d'", vector_meta.geometry_type);
+    if (result != WK_ABORT) {
+        if (reader->decoder != NULL) {
+            shp_handle_geometry_features_decoded(reader, &vector_meta);
+        } else {
+            shp_handle_geometry_features(reader, &vector_meta);
+        }
     }
 
     return reader->handler->vector_end(&vector_meta, reader->handler->handler_data);
@@ -104,20 +498,31 @@ SEXP shp_handle_geometry_with_cleanup(void* data) {
 void shp_handle_geometry_cleanup(void* data) {
     shp_reader_t* reader = (shp_reader_t*) data;
 
+    // stop the workers before the file they are reading is released
+    shp_decoder_stop(reader->decoder);
+
     reader->handler->deinitialize(reader->handler->handler_data);
 
-    if (reader->shp != NULL) {
-        shp_close(reader->shp);
-    }
+    shp_file_cache_release(reader->shp);
+
+    shp_decode_buffer_free(&reader->buffer);
 }
 
-SEXP shp_c_handle_geometry(SEXP shp_geometry, SEXP handler_xptr) {
+SEXP shp_c_handle_geometry(SEXP shp_geometry, SEXP handler_xptr, SEXP num_threads) {
     wk_handler_t* handler = (wk_handler_t*) R_ExternalPtrAddr(handler_xptr);
-    shp_reader_t reader = { shp_geometry, NULL, handler };
+    shp_reader_t reader;
+    memset(&reader, 0, sizeof(shp_reader_t));
+    reader.shp_geometry = shp_geometry;
+    reader.num_threads = INTEGER(num_threads)[0];
+    reader.shp = NULL;
+    reader.handler = handler;
+    reader.coord_span = NULL;
+    shp_decode_buffer_init(&reader.buffer);
+    reader.decoder = NULL;
     return R_ExecWithCleanup(
-        &shp_handle_geometry_with_cleanup, 
+        &shp_handle_geometry_with_cleanup,
         &reader,
-        &shp_handle_geometry_cleanup, 
+        &shp_handle_geometry_cleanup,
         &reader
     );
 }
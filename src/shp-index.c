@@ -0,0 +1,208 @@
+
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <R.h>
+#include <Rinternals.h>
+#include "shapefil.h"
+#include "shp-common.h"
+#include "shp-file-cache.h"
+#include "minishp-rtx.h"
+
+// The same limit that shapelib uses when estimating the depth
+#define SHP_QIX_MAX_DEFAULT_DEPTH 12
+
+typedef struct {
+    SEXP path;
+    SEXP qix_path;
+    SHPHandle hSHP;
+    SHPTree* tree;
+} shp_qix_builder_t;
+
+static void shp_build_qix_cleanup(void* data) {
+    shp_qix_builder_t* builder = (shp_qix_builder_t*) data;
+    if (builder->tree != NULL) {
+        SHPDestroyTree(builder->tree);
+    }
+
+    // The handle is shared with other users of the file cache, which
+    // expect SHPReadObject() to return objects they own
+    if (builder->hSHP != NULL) {
+        SHPSetFastModeReadObject(builder->hSHP, 0);
+    }
+
+    shp_file_cache_release_shapelib(builder->hSHP);
+}
+
+static SEXP shp_build_qix_with_cleanup(void* data) {
+    shp_qix_builder_t* builder = (shp_qix_builder_t*) data;
+    const char* path = CHAR(STRING_ELT(builder->path, 0));
+    const char* qix_path = CHAR(STRING_ELT(builder->qix_path, 0));
+
+    SHP_RESET_ERROR();
+    builder->hSHP = shp_file_cache_acquire_shapelib(path);
+    if (builder->hSHP == NULL) {
+        SHP_ERROR("%s", "SHPOpen: ");
+    }
+
+    int n_features;
+    double bounds_min[4], bounds_max[4];
+    SHPGetInfo(builder->hSHP, &n_features, NULL, bounds_min, bounds_max);
+
+    // Choose a depth that implies approximately 8 shapes per node like
+    // SHPCreateTree() does. We don't pass hSHP to SHPCreateTree() because it
+    // would read (and allocate) every shape in full.
+    int max_depth = 0;
+    int max_node_count = 1;
+    while ((max_node_count * 4) < n_features) {
+        max_depth++;
+        max_node_count *= 2;
+    }
+
+    if (max_depth > SHP_QIX_MAX_DEFAULT_DEPTH) {
+        max_depth = SHP_QIX_MAX_DEFAULT_DEPTH;
+    }
+
+    builder->tree = SHPCreateTree(NULL, 2, max_depth, bounds_min, bounds_max);
+    if (builder->tree == NULL) {
+        Rf_error("Failed to allocate quadtree");
+    }
+
+    // In fast mode, SHPReadObject() reuses a single SHPObject owned by the
+    // handle, so no allocations are made per shape (only the bounds are
+    // needed here).
+    SHPSetFastModeReadObject(builder->hSHP, 1);
+
+    SHPObject* obj;
+    for (int i = 0; i < n_features; i++) {
+        if ((i + 1) % 10000 == 0) R_CheckUserInterrupt();
+
+        obj = SHPReadObject(builder->hSHP, i);
+        if (obj == NULL) {
+            Rf_error("Error reading object for shape_id %d", i);
+        }
+
+        // null shapes never intersect a query
+        if (obj->nSHPType != SHPT_NULL) {
+            SHPTreeAddShapeId(builder->tree, obj);
+        }
+
+        SHPDestroyObject(obj);
+    }
+
+    SHPTreeTrimExtraNodes(builder->tree);
+
+    if (!SHPWriteTree(builder->tree, qix_path)) {
+        Rf_error("Failed to write qix file '%s'", qix_path);
+    }
+
+    return Rf_ScalarInteger(builder->tree->nTotalCount);
+}
+
+SEXP shp_c_build_qix(SEXP path, SEXP qix_path) {
+    shp_qix_builder_t builder = {path, qix_path, NULL, NULL};
+    return R_ExecWithCleanup(
+        &shp_build_qix_with_cleanup,
+        &builder,
+        &shp_build_qix_cleanup,
+        &builder
+    );
+}
+
+typedef struct {
+    SEXP path;
+    SEXP rtx_path;
+    int n_features;
+    shp_file_t* shp;
+    double* bounds;
+    uint32_t* ids;
+} shp_rtx_builder_t;
+
+static void shp_build_rtx_cleanup(void* data) {
+    shp_rtx_builder_t* builder = (shp_rtx_builder_t*) data;
+    shp_file_cache_release(builder->shp);
+    free(builder->bounds);
+    free(builder->ids);
+}
+
+static SEXP shp_build_rtx_with_cleanup(void* data) {
+    shp_rtx_builder_t* builder = (shp_rtx_builder_t*) data;
+    const char* path = Rf_translateCharUTF8(STRING_ELT(builder->path, 0));
+    const char* rtx_path = Rf_translateCharUTF8(STRING_ELT(builder->rtx_path, 0));
+    int n_features = builder->n_features;
+
+    // The size of the .shp is recorded in the index so that a stale
+    // index can be ignored when querying
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        Rf_error("Failed to stat shp file '%s'", path);
+    }
+
+    builder->shp = shp_file_cache_acquire(path);
+    if (!shp_valid(builder->shp)) {
+        Rf_error("%s", builder->shp->error_buf);
+    }
+
+    builder->bounds = (double*) malloc((n_features + 1) * 4 * sizeof(double));
+    builder->ids = (uint32_t*) malloc((n_features + 1) * sizeof(uint32_t));
+    if (builder->bounds == NULL || builder->ids == NULL) {
+        Rf_error("Failed to allocate bounds for %d features", n_features);
+    }
+
+    double* xmin = builder->bounds;
+    double* ymin = xmin + n_features;
+    double* xmax = ymin + n_features;
+    double* ymax = xmax + n_features;
+
+    // Only the record bounds are needed (or the coordinates of a point),
+    // which minishp reads without decoding any other coordinates.
+    int n_items = 0;
+    shp_shape_t shape;
+    for (int i = 0; i < n_features; i++) {
+        if ((i + 1) % 10000 == 0) R_CheckUserInterrupt();
+
+        if (shp_read_shape(builder->shp, i, &shape) != 0) {
+            Rf_error("[shape_id=%d] %s", i, builder->shp->error_buf);
+        }
+
+        // null shapes never intersect a query
+        if (shape.bounds != NULL) {
+            xmin[n_items] = shp_le_double(shape.bounds);
+            ymin[n_items] = shp_le_double(shape.bounds + 8);
+            xmax[n_items] = shp_le_double(shape.bounds + 16);
+            ymax[n_items] = shp_le_double(shape.bounds + 24);
+        } else if (shape.xy != NULL) {
+            xmin[n_items] = xmax[n_items] = shp_le_double(shape.xy);
+            ymin[n_items] = ymax[n_items] = shp_le_double(shape.xy + 8);
+        } else {
+            continue;
+        }
+
+        builder->ids[n_items++] = i;
+    }
+
+    char error_buf[RTX_ERROR_SIZE];
+    int result = rtx_write(
+        rtx_path, xmin, ymin, xmax, ymax, builder->ids, n_items,
+        RTX_DEFAULT_NODE_SIZE, n_features, (uint64_t) st.st_size,
+        error_buf
+    );
+
+    if (result != 0) {
+        Rf_error("%s", error_buf);
+    }
+
+    return Rf_ScalarInteger(n_items);
+}
+
+// The number of features is passed from R because the .shx may contain
+// trailing bytes beyond the length recorded in its header.
+SEXP shp_c_build_rtx(SEXP path, SEXP rtx_path, SEXP n_features) {
+    shp_rtx_builder_t builder = {path, rtx_path, INTEGER(n_features)[0], NULL, NULL, NULL};
+    return R_ExecWithCleanup(
+        &shp_build_rtx_with_cleanup,
+        &builder,
+        &shp_build_rtx_cleanup,
+        &builder
+    );
+}
@@ -1,10 +1,17 @@
 
 #include <R.h>
 #include <Rinternals.h>
+#include <R_ext/Rdynload.h>
 #include <memory.h>
+#include "shp-coord-span.h"
 
 extern char SALastError[1024];
 SEXP shp_c_shapelib_version();
+int shp_register_coord_span(shp_coord_fn_t coord, shp_coord_span_fn_t coord_span);
+int shp_writer_coord(const wk_meta_t* meta, const double* coord, uint32_t coord_id, void* handler_data);
+int shp_writer_coord_span(const wk_meta_t* meta, const double* coords, uint32_t n_coords,
+                          uint32_t stride, uint32_t coord_id, void* handler_data);
+void shp_init_c_callables(DllInfo* dll);
 
 SEXP shp_c_shapelib_version() {
   SEXP out = PROTECT(Rf_allocVector(STRSXP, 1));
@@ -12,3 +19,15 @@ SEXP shp_c_shapelib_version() {
   UNPROTECT(1);
   return out;
 }
+
+// Functions other packages can use with R_GetCCallable("shp", ...) (see
+// inst/include/shp-coord-span.h for their types). Called from
+// shp_init_callables() in shp-callables.cpp. The cast through
+// void (*)(void) is the conventional way to convert between function
+// pointer types without -Wcast-function-type.
+void shp_init_c_callables(DllInfo* dll) {
+  shp_register_coord_span(&shp_writer_coord, &shp_writer_coord_span);
+
+  shp_register_coord_span_t register_coord_span = &shp_register_coord_span;
+  R_RegisterCCallable("shp", "shp_register_coord_span", (DL_FUNC) (void (*)(void)) register_coord_span);
+}
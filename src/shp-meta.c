@@ -1,6 +1,8 @@
 
 #include "shapefil.h"
 #include "shp-common.h"
+#include "shp-file-cache.h"
+#include <stdlib.h>
 #include <memory.h>
 #include <Rinternals.h>
 
@@ -13,14 +15,14 @@ SEXP shp_c_file_meta(SEXP path) {
   SEXP outBoundsMin = PROTECT(Rf_allocVector(REALSXP, 4));
   SEXP outBoundsMax = PROTECT(Rf_allocVector(REALSXP, 4));
 
-  SHPHandle	hSHP = SHPOpen(path0, "rb");
+  SHPHandle	hSHP = shp_file_cache_acquire_shapelib(path0);
   if (hSHP == NULL) {
     SHP_ERROR("%s", "SHPOpen: ");
   }
 
   SHPGetInfo(hSHP, INTEGER(outRecords), INTEGER(outType), REAL(outBoundsMin), REAL(outBoundsMax));
 
-  SHPClose(hSHP);
+  shp_file_cache_release_shapelib(hSHP);
 
   const char *names[] = {"shp_type", "n_features", "bounds_min", "bounds_max", ""};
   SEXP out = PROTECT(Rf_mkNamed(VECSXP, names));
@@ -33,6 +35,213 @@ SEXP shp_c_file_meta(SEXP path) {
   return out;
 }
 
+// The number of bytes at the start of a record (including the 8-byte
+// record header) that contain the shape type, bounds, number of parts,
+// and number of points for any shape type
+#define SHP_META_HEAD_SIZE 52
+
+// The size of the buffer used to read runs of contiguous point records
+#define SHP_META_BLOCK_SIZE 65536
+
+typedef struct {
+  int n_parts;
+  int n_vertices;
+  double xmin, ymin, zmin, mmin;
+  double xmax, ymax, zmax, mmax;
+} shp_meta_bounds_t;
+
+static int shp_meta_read_at(SHPHandle hSHP, SAOffset offset, void* dest, int size) {
+  if (hSHP->sHooks.FSeek(hSHP->fpSHP, offset, 0) != 0) {
+    return 0;
+  }
+
+  return (int) hSHP->sHooks.FRead(dest, 1, size, hSHP->fpSHP);
+}
+
+// Extracts the same values that SHPReadObject() would in fast mode without
+// reading the coordinates. `rec` contains the first `n_rec` bytes of the
+// record starting with the record header; the z and m ranges of
+// non-point shapes (which follow the coordinates) are read separately.
+// Returns nonzero if the record is corrupt or can't be read.
+static int shp_meta_parse_bounds(SHPHandle hSHP, SAOffset fileSize, int hEntity,
+                                 const unsigned char* rec, int n_rec, shp_meta_bounds_t* out) {
+  int nEntitySize = (int) hSHP->panRecSize[hEntity] + 8;
+  SAOffset recOffset = hSHP->panRecOffset[hEntity];
+  unsigned char range[16];
+
+  memset(out, 0, sizeof(shp_meta_bounds_t));
+  out->mmin = NA_REAL;
+  out->mmax = NA_REAL;
+
+  if (n_rec < 12 || nEntitySize < 12) {
+    return 1;
+  }
+
+  // Because the whole record isn't read, check that it is actually in the
+  // file. Like shapelib, allow a .shx content length that (incorrectly)
+  // includes the 8-byte record header (nEntitySize >= 12 here, so
+  // nEntitySize - 8 isn't negative).
+  if ((recOffset + nEntitySize) > fileSize) {
+    if ((recOffset + nEntitySize - 8) != fileSize ||
+        (2 * (SAOffset) shp_be_uint32(rec + 4) + 8) != (SAOffset) (nEntitySize - 8)) {
+      return 1;
+    }
+  }
+
+  int nSHPType = (int) shp_le_uint32(rec + 8);
+  int nOffset;
+  uint32_t nPoints, nParts;
+
+  switch (nSHPType) {
+  case SHPT_POINT:
+  case SHPT_POINTM:
+  case SHPT_POINTZ:
+    nOffset = 28 + ((nSHPType == SHPT_POINTZ) ? 8 : 0);
+    if (nOffset > nEntitySize || nOffset > n_rec) {
+      return 1;
+    }
+
+    out->n_vertices = 1;
+    out->xmin = out->xmax = shp_le_double(rec + 12);
+    out->ymin = out->ymax = shp_le_double(rec + 20);
+    if (nSHPType == SHPT_POINTZ) {
+      out->zmin = out->zmax = shp_le_double(rec + 28);
+    }
+
+    if (nEntitySize >= (nOffset + 8) && n_rec >= (nOffset + 8)) {
+      out->mmin = out->mmax = shp_le_double(rec + nOffset);
+    }
+
+    return 0;
+
+  case SHPT_MULTIPOINT:
+  case SHPT_MULTIPOINTM:
+  case SHPT_MULTIPOINTZ:
+  case SHPT_ARC:
+  case SHPT_ARCM:
+  case SHPT_ARCZ:
+  case SHPT_POLYGON:
+  case SHPT_POLYGONM:
+  case SHPT_POLYGONZ:
+  case SHPT_MULTIPATCH:
+    break;
+
+  default:
+    // null shapes (and shape types shapelib doesn't know about) have
+    // no vertices and zero bounds
+    return 0;
+  }
+
+  int isMultipoint = nSHPType == SHPT_MULTIPOINT ||
+    nSHPType == SHPT_MULTIPOINTM ||
+    nSHPType == SHPT_MULTIPOINTZ;
+  int hasZ = nSHPType == SHPT_MULTIPOINTZ ||
+    nSHPType == SHPT_ARCZ ||
+    nSHPType == SHPT_POLYGONZ ||
+    nSHPType == SHPT_MULTIPATCH;
+
+  if (isMultipoint) {
+    if (48 > nEntitySize || 48 > n_rec) {
+      return 1;
+    }
+
+    nParts = 0;
+    nPoints = shp_le_uint32(rec + 44);
+    if (nPoints > 50 * 1000 * 1000) {
+      return 1;
+    }
+
+    nOffset = 48 + 16 * nPoints;
+  } else {
+    if (SHP_META_HEAD_SIZE > nEntitySize || SHP_META_HEAD_SIZE > n_rec) {
+      return 1;
+    }
+
+    nParts = shp_le_uint32(rec + 44);
+    nPoints = shp_le_uint32(rec + 48);
+    if (nPoints > 50 * 1000 * 1000 || nParts > 10 * 1000 * 1000) {
+      return 1;
+    }
+
+    nOffset = 44 + 8 + 4 * nParts + 16 * nPoints;
+    if (nSHPType == SHPT_MULTIPATCH) {
+      nOffset += 4 * nParts;
+    }
+  }
+
+  if ((nOffset + (hasZ ? 16 + 8 * (int) nPoints : 0)) > nEntitySize) {
+    return 1;
+  }
+
+  out->n_parts = (int) nParts;
+  out->n_vertices = (int) nPoints;
+  out->xmin = shp_le_double(rec + 12);
+  out->ymin = shp_le_double(rec + 20);
+  out->xmax = shp_le_double(rec + 28);
+  out->ymax = shp_le_double(rec + 36);
+
+  if (hasZ) {
+    if (shp_meta_read_at(hSHP, recOffset + nOffset, range, 16) != 16) {
+      return 1;
+    }
+
+    out->zmin = shp_le_double(range);
+    out->zmax = shp_le_double(range + 8);
+    nOffset += 16 + 8 * nPoints;
+  }
+
+  // like shapelib, a measure is present for any shape if the record is
+  // long enough to contain one
+  if (nEntitySize >= (nOffset + 16 + 8 * (int) nPoints) &&
+      shp_meta_read_at(hSHP, recOffset + nOffset, range, 16) == 16) {
+    out->mmin = shp_le_double(range);
+    out->mmax = shp_le_double(range + 8);
+  }
+
+  return 0;
+}
+
+// Reads the head of a single record and parses its bounds
+static int shp_meta_read_bounds(SHPHandle hSHP, SAOffset fileSize, int hEntity,
+                                shp_meta_bounds_t* out) {
+  unsigned char rec[SHP_META_HEAD_SIZE];
+  int nEntitySize = (int) hSHP->panRecSize[hEntity] + 8;
+  int n_rec = nEntitySize < SHP_META_HEAD_SIZE ? nEntitySize : SHP_META_HEAD_SIZE;
+  n_rec = shp_meta_read_at(hSHP, hSHP->panRecOffset[hEntity], rec, n_rec);
+  return shp_meta_parse_bounds(hSHP, fileSize, hEntity, rec, n_rec, out);
+}
+
+// The number of records starting at pIndices[i] that are consecutive
+// shape ids stored contiguously in the .shp and fit in a single block
+static int shp_meta_contiguous_run(SHPHandle hSHP, int* pIndices, int i, int size, int nFeatures) {
+  int hEntity = pIndices[i] - 1;
+  unsigned int blockEnd = hSHP->panRecOffset[hEntity] + hSHP->panRecSize[hEntity] + 8;
+  unsigned int blockSize = blockEnd - hSHP->panRecOffset[hEntity];
+  if (blockSize > SHP_META_BLOCK_SIZE) {
+    return 1;
+  }
+
+  int n = 1;
+  while ((i + n) < size) {
+    int next = pIndices[i + n];
+    if (next == NA_INTEGER || next != (hEntity + n + 1) || next > nFeatures ||
+        hSHP->panRecOffset[next - 1] != blockEnd) {
+      break;
+    }
+
+    unsigned int recSize = hSHP->panRecSize[next - 1] + 8;
+    if ((blockSize + recSize) > SHP_META_BLOCK_SIZE) {
+      break;
+    }
+
+    blockEnd += recSize;
+    blockSize += recSize;
+    n++;
+  }
+
+  return n;
+}
+
 SEXP shp_c_geometry_meta(SEXP path, SEXP indices) {
   SHP_RESET_ERROR();
 
@@ -66,19 +275,34 @@ SEXP shp_c_geometry_meta(SEXP path, SEXP indices) {
   double* pMMax = REAL(mMax);
 
   const char* path0 = CHAR(STRING_ELT(path, 0));
-  SHPHandle	hSHP = SHPOpen(path0, "rb");
+  SHPHandle	hSHP = shp_file_cache_acquire_shapelib(path0);
   if (hSHP == NULL) {
     SHP_ERROR("%s", "SHPOpen: ");
   }
 
-  // fast read mode skips a few steps that aren't needed
-  // to extract number of parts, number of vertices, and
-  // bounds for each feature
-  SHPSetFastModeReadObject(hSHP, 1);
   int nFeatures = hSHP->nRecords;
+  hSHP->sHooks.FSeek(hSHP->fpSHP, 0, 2);
+  SAOffset fileSize = hSHP->sHooks.FTell(hSHP->fpSHP);
+
+  // Only the first few bytes of each record are needed, so records are
+  // read individually using the offsets from the .shx instead of in full
+  // (which would read every coordinate). Point records are small enough
+  // that runs of them are read in blocks.
+  int isPointFile = hSHP->nShapeType == SHPT_POINT ||
+    hSHP->nShapeType == SHPT_POINTM ||
+    hSHP->nShapeType == SHPT_POINTZ;
+  unsigned char* block = NULL;
+  if (isPointFile) {
+    block = (unsigned char*) malloc(SHP_META_BLOCK_SIZE);
+    if (block == NULL) {
+      shp_file_cache_release_shapelib(hSHP);
+      Rf_error("Failed to allocate read buffer of size %d", SHP_META_BLOCK_SIZE);
+    }
+  }
 
-  SHPObject* obj;
-  for (int i = 0; i < size; i++) {
+  shp_meta_bounds_t bounds;
+  int i = 0;
+  while (i < size) {
     // these are R-style 1-based indices
     if (pIndices[i] == NA_INTEGER || pIndices[i] > nFeatures) {
       pShapeId[i] = NA_INTEGER;
@@ -92,37 +316,66 @@ SEXP shp_c_geometry_meta(SEXP path, SEXP indices) {
       pYMax[i] = NA_REAL;
       pZMax[i] = NA_REAL;
       pMMax[i] = NA_REAL;
+      i++;
       continue;
     }
 
-    obj = SHPReadObject(hSHP, pIndices[i] - 1);
-    if (obj == NULL) {
-      SHPClose(hSHP);
-      Rf_error("[i=%d] Error reading object for index %d", i + 1, pIndices[i]);
+    int n_run = 1;
+    int n_block = 0;
+    if (block != NULL && pIndices[i] > 0) {
+      n_run = shp_meta_contiguous_run(hSHP, pIndices, i, size, nFeatures);
+      if (n_run > 1) {
+        int hEntityLast = pIndices[i + n_run - 1] - 1;
+        int blockSize = (int) (hSHP->panRecOffset[hEntityLast] + hSHP->panRecSize[hEntityLast] + 8 -
+          hSHP->panRecOffset[pIndices[i] - 1]);
+        n_block = shp_meta_read_at(hSHP, hSHP->panRecOffset[pIndices[i] - 1], block, blockSize);
+
+        // a short read means a truncated file: let the single-record path
+        // handle (or report) it
+        if (n_block != blockSize) {
+          n_run = 1;
+          n_block = 0;
+        }
+      }
     }
 
-    pShapeId[i] = obj->nShapeId;
-    pNparts[i] = obj->nParts;
-    pNvertices[i] = obj->nVertices;
-    pXMin[i] = obj->dfXMin;
-    pYMin[i] = obj->dfYMin;
-    pZMin[i] = obj->dfZMin;
-    pXMax[i] = obj->dfXMax;
-    pYMax[i] = obj->dfYMax;
-    pZMax[i] = obj->dfZMax;
+    for (int j = i; j < (i + n_run); j++) {
+      int hEntity = pIndices[j] - 1;
+      int result;
+      if (hEntity < 0) {
+        result = 1;
+      } else if (n_block > 0) {
+        unsigned int recStart = hSHP->panRecOffset[hEntity] - hSHP->panRecOffset[pIndices[i] - 1];
+        int nEntitySize = (int) hSHP->panRecSize[hEntity] + 8;
+        result = shp_meta_parse_bounds(hSHP, fileSize, hEntity, block + recStart, nEntitySize, &bounds);
+      } else {
+        result = shp_meta_read_bounds(hSHP, fileSize, hEntity, &bounds);
+      }
 
-    if (obj->bMeasureIsUsed) {
-      pMMin[i] = obj->dfMMin;
-      pMMax[i] = obj->dfMMax;
-    } else {
-      pMMin[i] = NA_REAL;
-      pMMax[i] = NA_REAL;
+      if (result != 0) {
+        free(block);
+        shp_file_cache_release_shapelib(hSHP);
+        Rf_error("[i=%d] Error reading object for index %d", j + 1, pIndices[j]);
+      }
+
+      pShapeId[j] = hEntity;
+      pNparts[j] = bounds.n_parts;
+      pNvertices[j] = bounds.n_vertices;
+      pXMin[j] = bounds.xmin;
+      pYMin[j] = bounds.ymin;
+      pZMin[j] = bounds.zmin;
+      pMMin[j] = bounds.mmin;
+      pXMax[j] = bounds.xmax;
+      pYMax[j] = bounds.ymax;
+      pZMax[j] = bounds.zmax;
+      pMMax[j] = bounds.mmax;
     }
 
-    SHPDestroyObject(obj);
+    i += n_run;
   }
 
-  SHPClose(hSHP);
+  free(block);
+  shp_file_cache_release_shapelib(hSHP);
 
   const char *names[] = {
     "shape_id", "n_parts", "n_vertices",
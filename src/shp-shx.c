@@ -1,6 +1,7 @@
 
 #include <R.h>
 #include <Rinternals.h>
+#include <string.h>
 #include "minishp-shx.h"
 
 SEXP shp_c_shx_meta(SEXP filename) {
@@ -8,8 +9,10 @@ SEXP shp_c_shx_meta(SEXP filename) {
     int n_features = NA_INTEGER;
     shx_file_t* shx = shx_open(filename_utf8);
     if (!shx_valid(shx)) {
+        char error_buf[SHX_ERROR_SIZE];
+        memcpy(error_buf, shx->error_buf, SHX_ERROR_SIZE);
         shx_close(shx);
-        Rf_error(shx->error_buf);
+        Rf_error("%s", error_buf);
     }
 
     n_features = (int) shx_n_records(shx);
@@ -24,36 +27,82 @@ SEXP shp_c_shx_meta(SEXP filename) {
 
 }
 
-SEXP shp_c_read_shx(SEXP filename, SEXP indices_sexp) {
-    const char* filename_utf8 = Rf_translateCharUTF8(STRING_ELT(filename, 0));
-    int size = Rf_length(indices_sexp);
-    int* indices = INTEGER(indices_sexp);
+typedef struct {
+    SEXP filename;
+    SEXP indices;
+    int return_cache_stats;
+    shx_file_t* shx;
+} shp_read_shx_t;
+
+static void shp_read_shx_cleanup(void* data) {
+    shp_read_shx_t* read_shx = (shp_read_shx_t*) data;
+    shx_close(read_shx->shx);
+}
+
+static SEXP shp_read_shx_with_cleanup(void* data) {
+    shp_read_shx_t* read_shx = (shp_read_shx_t*) data;
+    const char* filename_utf8 = Rf_translateCharUTF8(STRING_ELT(read_shx->filename, 0));
+
+    read_shx->shx = shx_open(filename_utf8);
+    shx_file_t* shx = read_shx->shx;
+    if (!shx_valid(shx)) {
+        Rf_error("%s", shx->error_buf);
+    }
+
+    // NULL indices means all records, which are read with a single read
+    // and copied in order
+    uint32_t n_records = shx_n_records(shx);
+    int all = read_shx->indices == R_NilValue;
+    R_xlen_t size = all ? (R_xlen_t) n_records : Rf_xlength(read_shx->indices);
+    if (shx_load_if_dense(shx, size) != 0) {
+        Rf_error("%s", shx->error_buf);
+    }
+
     SEXP offset_sexp = PROTECT(Rf_allocVector(INTSXP, size));
     SEXP content_length_sexp = PROTECT(Rf_allocVector(INTSXP, size));
     int* offset = INTEGER(offset_sexp);
     int* content_length = INTEGER(content_length_sexp);
 
-    shx_file_t* shx = shx_open(filename_utf8);
-    if (!shx_valid(shx)) {
-        shx_close(shx);
-        Rf_error(shx->error_buf);
-    }
+    if (all) {
+        for (R_xlen_t i = 0; i < size; i++) {
+            offset[i] = shx->table[i].offset;
+            content_length[i] = shx->table[i].content_length;
+        }
+    } else {
+        // indices are 0-based and can be in any order: each record is
+        // written directly to its position in the output
+        int* indices = INTEGER(read_shx->indices);
+        shx_record_t* record;
+        for (R_xlen_t i = 0; i < size; i++) {
+            if ((i + 1) % 100000 == 0) R_CheckUserInterrupt();
 
-    shx_record_t* record;
-    for (int i = 0; i < size; i++) {
-        if ((i + 1) % 1000 == 0) R_CheckUserInterrupt();
-
-        record = shx_record(shx, indices[i]);
-        if (record == NULL) {
-            offset[i] = NA_INTEGER;
-            content_length[i] = NA_INTEGER;
-        } else {
-            offset[i] = record->offset;
-            content_length[i] = record->content_length;
-        }   
+            if (indices[i] == NA_INTEGER || indices[i] < 0) {
+                record = NULL;
+            } else {
+                record = shx_record(shx, indices[i]);
+            }
+
+            if (record == NULL) {
+                offset[i] = NA_INTEGER;
+                content_length[i] = NA_INTEGER;
+            } else {
+                offset[i] = record->offset;
+                content_length[i] = record->content_length;
+            }
+        }
     }
 
-    shx_close(shx);
+    if (read_shx->return_cache_stats) {
+        shx_cache_stats_t stats = shx_cache_stats(shx);
+        const char* names[] = {"loaded", "n_hits", "n_misses", "n_records_read", ""};
+        SEXP output = PROTECT(Rf_mkNamed(VECSXP, names));
+        SET_VECTOR_ELT(output, 0, Rf_ScalarLogical(shx->table != NULL));
+        SET_VECTOR_ELT(output, 1, Rf_ScalarReal(stats.n_hits));
+        SET_VECTOR_ELT(output, 2, Rf_ScalarReal(stats.n_misses));
+        SET_VECTOR_ELT(output, 3, Rf_ScalarReal(stats.n_records_read));
+        UNPROTECT(3);
+        return output;
+    }
 
     const char* names[] = {"offset", "content_length", ""};
     SEXP output = PROTECT(Rf_mkNamed(VECSXP, names));
@@ -62,3 +111,25 @@ SEXP shp_c_read_shx(SEXP filename, SEXP indices_sexp) {
     UNPROTECT(3);
     return output;
 }
+
+SEXP shp_c_read_shx(SEXP filename, SEXP indices_sexp) {
+    shp_read_shx_t read_shx = {filename, indices_sexp, 0, NULL};
+    return R_ExecWithCleanup(
+        &shp_read_shx_with_cleanup,
+        &read_shx,
+        &shp_read_shx_cleanup,
+        &read_shx
+    );
+}
+
+// Reads the same records as shp_c_read_shx() but returns the .shx cache
+// statistics instead of the records (for testing the caching strategy)
+SEXP shp_c_read_shx_cache_stats(SEXP filename, SEXP indices_sexp) {
+    shp_read_shx_t read_shx = {filename, indices_sexp, 1, NULL};
+    return R_ExecWithCleanup(
+        &shp_read_shx_with_cleanup,
+        &read_shx,
+        &shp_read_shx_cleanup,
+        &read_shx
+    );
+}
@@ -0,0 +1,702 @@
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <R.h>
+#include <Rinternals.h>
+#include "minishp-shp.h"
+#include "wk-v1.h"
+#include "wk-v1-impl.c"
+
+// Records are written to the .shp and .shx through buffers of this size
+// so that the files are written in a few large blocks. Each file is
+// written in one pass with a placeholder header that is patched once the
+// file length, shape type, and bounds are known.
+#ifndef SHP_WRITE_BUFFER_SIZE
+#define SHP_WRITE_BUFFER_SIZE 4194304
+#endif
+
+#define SHP_HEADER_SIZE 100
+
+// Lengths and offsets in the .shp and .shx are signed 32-bit counts of
+// 16-bit words
+#define SHP_MAX_FILE_SIZE (((uint64_t) INT32_MAX) * 2)
+
+// Any measure less than -10^38 is "no data" (see shp_measure_is_nodata())
+#define SHP_MEASURE_NODATA -1e39
+
+typedef struct {
+    char* filename;
+    FILE* file;
+    unsigned char* data;
+    size_t size;
+    // the number of bytes written so far (including the buffer)
+    uint64_t offset;
+} shp_write_buffer_t;
+
+typedef struct {
+    shp_write_buffer_t shp;
+    shp_write_buffer_t shx;
+    // SHP_TYPE_NULL until it is known from the vector or the first
+    // non-null feature
+    uint32_t shape_type;
+    int32_t n_records;
+    // xmin, ymin, xmax, ymax, zmin, zmax, mmin, mmax of every record
+    double bounds[8];
+
+    // The current feature. Coordinates are accumulated as they would be
+    // written to the record: interleaved x/y with separate z and m arrays.
+    int feature_null;
+    uint32_t feature_type;
+    uint32_t feature_flags;
+    int level;
+    uint32_t n_points;
+    uint32_t points_capacity;
+    double* xy;
+    double* z;
+    double* m;
+    uint32_t n_parts;
+    uint32_t parts_capacity;
+    uint32_t* parts;
+} shp_writer_t;
+
+void shp_write_buffer_init(shp_write_buffer_t* buffer) {
+    buffer->filename = NULL;
+    buffer->file = NULL;
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->offset = 0;
+}
+
+void shp_write_buffer_open(shp_write_buffer_t* buffer) {
+    buffer->data = (unsigned char*) malloc(SHP_WRITE_BUFFER_SIZE);
+    if (buffer->data == NULL) {
+        Rf_error("Failed to allocate output buffer for '%s'", buffer->filename);
+    }
+
+    buffer->file = fopen(buffer->filename, "wb");
+    if (buffer->file == NULL) {
+        Rf_error("Can't open '%s' for writing", buffer->filename);
+    }
+}
+
+void shp_write_buffer_flush(shp_write_buffer_t* buffer) {
+    if ((buffer->size > 0) && (fwrite(buffer->data, 1, buffer->size, buffer->file) != buffer->size)) {
+        Rf_error("Failed to write to '%s'", buffer->filename);
+    }
+
+    buffer->size = 0;
+}
+
+void shp_write_buffer_close(shp_write_buffer_t* buffer) {
+    if (buffer->file != NULL) {
+        fclose(buffer->file);
+        buffer->file = NULL;
+    }
+}
+
+void shp_write_buffer_free(shp_write_buffer_t* buffer) {
+    shp_write_buffer_close(buffer);
+    free(buffer->data);
+    free(buffer->filename);
+    shp_write_buffer_init(buffer);
+}
+
+static inline void shp_write_bytes(shp_write_buffer_t* buffer, const void* data, size_t size) {
+    if ((buffer->size + size) > SHP_WRITE_BUFFER_SIZE) {
+        shp_write_buffer_flush(buffer);
+    }
+
+    if (size > SHP_WRITE_BUFFER_SIZE) {
+        if (fwrite(data, 1, size, buffer->file) != size) {
+            Rf_error("Failed to write to '%s'", buffer->filename);
+        }
+    } else {
+        memcpy(buffer->data + buffer->size, data, size);
+        buffer->size += size;
+    }
+
+    buffer->offset += size;
+}
+
+static inline void shp_write_le_int32(shp_write_buffer_t* buffer, uint32_t value) {
+    unsigned char bytes[4] = {
+        (unsigned char) value,
+        (unsigned char) (value >> 8),
+        (unsigned char) (value >> 16),
+        (unsigned char) (value >> 24)
+    };
+    shp_write_bytes(buffer, bytes, 4);
+}
+
+static inline void shp_write_be_int32(shp_write_buffer_t* buffer, uint32_t value) {
+    unsigned char bytes[4] = {
+        (unsigned char) (value >> 24),
+        (unsigned char) (value >> 16),
+        (unsigned char) (value >> 8),
+        (unsigned char) value
+    };
+    shp_write_bytes(buffer, bytes, 4);
+}
+
+// On little endian platforms, arrays of coordinates are copied as-is
+static inline void shp_write_le_doubles(shp_write_buffer_t* buffer, const double* values, size_t n) {
+#ifdef IS_BIG_ENDIAN
+    unsigned char bytes[8];
+    for (size_t i = 0; i < n; i++) {
+        memcpy(bytes, values + i, 8);
+        for (int j = 0; j < 4; j++) {
+            unsigned char tmp = bytes[j];
+            bytes[j] = bytes[7 - j];
+            bytes[7 - j] = tmp;
+        }
+        shp_write_bytes(buffer, bytes, 8);
+    }
+#else
+    shp_write_bytes(buffer, values, n * sizeof(double));
+#endif
+}
+
+static inline void shp_write_le_double(shp_write_buffer_t* buffer, double value) {
+    shp_write_le_doubles(buffer, &value, 1);
+}
+
+// Rewrites the placeholder header at the start of the file (the .shp and
+// .shx headers only differ by their file length)
+void shp_write_buffer_finish(shp_write_buffer_t* buffer, uint32_t shape_type, const double* bounds) {
+    shp_write_buffer_flush(buffer);
+    uint64_t file_size = buffer->offset;
+
+    if (fseek(buffer->file, 0, SEEK_SET) != 0) {
+        Rf_error("Failed to seek to the start of '%s'", buffer->filename);
+    }
+
+    shp_write_be_int32(buffer, 9994);
+    for (int i = 0; i < 5; i++) {
+        shp_write_be_int32(buffer, 0);
+    }
+    shp_write_be_int32(buffer, (uint32_t) (file_size / 2));
+    shp_write_le_int32(buffer, 1000);
+    shp_write_le_int32(buffer, shape_type);
+    shp_write_le_doubles(buffer, bounds, 8);
+    shp_write_buffer_flush(buffer);
+
+    if (fclose(buffer->file) != 0) {
+        buffer->file = NULL;
+        Rf_error("Failed to close '%s'", buffer->filename);
+    }
+
+    buffer->file = NULL;
+}
+
+void shp_writer_reserve_points(shp_writer_t* writer, uint32_t n) {
+    if ((writer->n_points + n) <= writer->points_capacity) {
+        return;
+    }
+
+    uint32_t capacity = writer->points_capacity * 2;
+    if (capacity < (writer->n_points + n)) {
+        capacity = writer->n_points + n + 64;
+    }
+
+    double* xy = (double*) realloc(writer->xy, capacity * 2 * sizeof(double));
+    if (xy == NULL) Rf_error("Failed to allocate coordinate buffer");
+    writer->xy = xy;
+    double* z = (double*) realloc(writer->z, capacity * sizeof(double));
+    if (z == NULL) Rf_error("Failed to allocate coordinate buffer");
+    writer->z = z;
+    double* m = (double*) realloc(writer->m, capacity * sizeof(double));
+    if (m == NULL) Rf_error("Failed to allocate coordinate buffer");
+    writer->m = m;
+
+    writer->points_capacity = capacity;
+}
+
+void shp_writer_push_part(shp_writer_t* writer) {
+    if (writer->n_parts == writer->parts_capacity) {
+        uint32_t capacity = writer->parts_capacity * 2 + 16;
+        uint32_t* parts = (uint32_t*) realloc(writer->parts, capacity * sizeof(uint32_t));
+        if (parts == NULL) Rf_error("Failed to allocate part buffer");
+        writer->parts = parts;
+        writer->parts_capacity = capacity;
+    }
+
+    writer->parts[writer->n_parts++] = writer->n_points;
+}
+
+void shp_writer_copy_point(shp_writer_t* writer, uint32_t from, uint32_t to) {
+    writer->xy[to * 2] = writer->xy[from * 2];
+    writer->xy[to * 2 + 1] = writer->xy[from * 2 + 1];
+    writer->z[to] = writer->z[from];
+    writer->m[to] = writer->m[from];
+}
+
+// Shapefile rings are closed, with outer rings clockwise and holes
+// counterclockwise
+void shp_writer_finish_ring(shp_writer_t* writer, uint32_t ring_id) {
+    uint32_t start = writer->parts[writer->n_parts - 1];
+    if (writer->n_points == start) {
+        writer->n_parts--;
+        return;
+    }
+
+    uint32_t last = writer->n_points - 1;
+    if ((writer->xy[start * 2] != writer->xy[last * 2]) ||
+        (writer->xy[start * 2 + 1] != writer->xy[last * 2 + 1])) {
+        shp_writer_reserve_points(writer, 1);
+        shp_writer_copy_point(writer, start, writer->n_points);
+        writer->n_points++;
+    }
+
+    const double* xy = writer->xy;
+    double area = 0;
+    for (uint32_t i = start; (i + 1) < writer->n_points; i++) {
+        area += xy[i * 2] * xy[i * 2 + 3] - xy[i * 2 + 2] * xy[i * 2 + 1];
+    }
+
+    int clockwise = area < 0;
+    if ((ring_id == 0) == clockwise) {
+        return;
+    }
+
+    for (uint32_t i = start, j = writer->n_points - 1; i < j; i++, j--) {
+        double tmp[4] = {writer->xy[i * 2], writer->xy[i * 2 + 1], writer->z[i], writer->m[i]};
+        shp_writer_copy_point(writer, j, i);
+        writer->xy[j * 2] = tmp[0];
+        writer->xy[j * 2 + 1] = tmp[1];
+        writer->z[j] = tmp[2];
+        writer->m[j] = tmp[3];
+    }
+}
+
+uint32_t shp_writer_shape_type(uint32_t geometry_type, uint32_t flags) {
+    uint32_t shape_type;
+    switch (geometry_type) {
+    case WK_POINT:
+        shape_type = SHP_TYPE_POINT;
+        break;
+    case WK_LINESTRING:
+    case WK_MULTILINESTRING:
+        shape_type = SHP_TYPE_POLYLINE;
+        break;
+    case WK_POLYGON:
+    case WK_MULTIPOLYGON:
+        shape_type = SHP_TYPE_POLYGON;
+        break;
+    case WK_MULTIPOINT:
+        shape_type = SHP_TYPE_MULTIPOINT;
+        break;
+    default:
+        return SHP_TYPE_NULL;
+    }
+
+    // Z shapes can also have measures, so XYZM shapes are Z shapes
+    if (flags & WK_FLAG_HAS_Z) {
+        return shape_type + 10;
+    } else if (flags & WK_FLAG_HAS_M) {
+        return shape_type + 20;
+    } else {
+        return shape_type;
+    }
+}
+
+const char* shp_writer_type_label(uint32_t shape_type) {
+    switch (shape_type % 10) {
+    case SHP_TYPE_POINT: return "point";
+    case SHP_TYPE_POLYLINE: return "polyline";
+    case SHP_TYPE_POLYGON: return "polygon";
+    case SHP_TYPE_MULTIPOINT: return "multipoint";
+    default: return "unknown";
+    }
+}
+
+void shp_writer_write_record(shp_writer_t* writer, uint32_t shape_type) {
+    uint32_t n_points = writer->n_points;
+    uint32_t n_parts = writer->n_parts;
+    uint32_t base_type = shape_type % 10;
+    // measures are optional for Z shapes
+    int has_z = shp_shape_type_has_z(shape_type);
+    int has_m = shp_shape_type_has_m(shape_type) || (has_z && (writer->feature_flags & WK_FLAG_HAS_M));
+
+    // xmin, ymin, xmax, ymax, zmin, zmax, mmin, mmax
+    double bounds[8] = {R_PosInf, R_PosInf, R_NegInf, R_NegInf, R_PosInf, R_NegInf, R_PosInf, R_NegInf};
+    for (uint32_t i = 0; i < n_points; i++) {
+        double x = writer->xy[i * 2];
+        double y = writer->xy[i * 2 + 1];
+        double m = writer->m[i];
+        if (x < bounds[0]) bounds[0] = x;
+        if (y < bounds[1]) bounds[1] = y;
+        if (x > bounds[2]) bounds[2] = x;
+        if (y > bounds[3]) bounds[3] = y;
+        if (writer->z[i] < bounds[4]) bounds[4] = writer->z[i];
+        if (writer->z[i] > bounds[5]) bounds[5] = writer->z[i];
+
+        if (ISNAN(m)) {
+            writer->m[i] = SHP_MEASURE_NODATA;
+        } else {
+            if (m < bounds[6]) bounds[6] = m;
+            if (m > bounds[7]) bounds[7] = m;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (bounds[i] < writer->bounds[i]) writer->bounds[i] = bounds[i];
+        if (bounds[i + 2] > writer->bounds[i + 2]) writer->bounds[i + 2] = bounds[i + 2];
+    }
+    for (int i = 4; i < 8; i += 2) {
+        if (bounds[i] < writer->bounds[i]) writer->bounds[i] = bounds[i];
+        if (bounds[i + 1] > writer->bounds[i + 1]) writer->bounds[i + 1] = bounds[i + 1];
+    }
+
+    if (bounds[6] > bounds[7]) {
+        bounds[6] = SHP_MEASURE_NODATA;
+        bounds[7] = SHP_MEASURE_NODATA;
+    }
+
+    uint64_t content_length;
+    switch (base_type) {
+    case SHP_TYPE_POINT:
+        content_length = 20 + has_z * 8 + has_m * 8;
+        break;
+    case SHP_TYPE_MULTIPOINT:
+        content_length = 40 + (uint64_t) n_points * 16;
+        break;
+    default:
+        content_length = 44 + (uint64_t) n_parts * 4 + (uint64_t) n_points * 16;
+        break;
+    }
+
+    if (base_type != SHP_TYPE_POINT) {
+        content_length += has_z * (16 + (uint64_t) n_points * 8);
+        content_length += has_m * (16 + (uint64_t) n_points * 8);
+    }
+
+    if ((writer->shp.offset + 8 + content_length) > SHP_MAX_FILE_SIZE) {
+        Rf_error("Can't write a .shp file larger than %.0f bytes", (double) SHP_MAX_FILE_SIZE);
+    }
+
+    shp_write_be_int32(&writer->shx, (uint32_t) (writer->shp.offset / 2));
+    shp_write_be_int32(&writer->shx, (uint32_t) (content_length / 2));
+
+    shp_write_be_int32(&writer->shp, writer->n_records + 1);
+    shp_write_be_int32(&writer->shp, (uint32_t) (content_length / 2));
+    shp_write_le_int32(&writer->shp, shape_type);
+
+    if (base_type == SHP_TYPE_POINT) {
+        shp_write_le_doubles(&writer->shp, writer->xy, 2);
+        if (has_z) shp_write_le_double(&writer->shp, writer->z[0]);
+        if (has_m) shp_write_le_double(&writer->shp, writer->m[0]);
+    } else {
+        shp_write_le_doubles(&writer->shp, bounds, 4);
+        if (base_type == SHP_TYPE_MULTIPOINT) {
+            shp_write_le_int32(&writer->shp, n_points);
+        } else {
+            shp_write_le_int32(&writer->shp, n_parts);
+            shp_write_le_int32(&writer->shp, n_points);
+            for (uint32_t i = 0; i < n_parts; i++) {
+                shp_write_le_int32(&writer->shp, writer->parts[i]);
+            }
+        }
+
+        shp_write_le_doubles(&writer->shp, writer->xy, (size_t) n_points * 2);
+        if (has_z) {
+            shp_write_le_doubles(&writer->shp, bounds + 4, 2);
+            shp_write_le_doubles(&writer->shp, writer->z, n_points);
+        }
+        if (has_m) {
+            shp_write_le_doubles(&writer->shp, bounds + 6, 2);
+            shp_write_le_doubles(&writer->shp, writer->m, n_points);
+        }
+    }
+
+    writer->n_records++;
+}
+
+void shp_writer_write_null(shp_writer_t* writer) {
+    if ((writer->shp.offset + 12) > SHP_MAX_FILE_SIZE) {
+        Rf_error("Can't write a .shp file larger than %.0f bytes", (double) SHP_MAX_FILE_SIZE);
+    }
+
+    shp_write_be_int32(&writer->shx, (uint32_t) (writer->shp.offset / 2));
+    shp_write_be_int32(&writer->shx, 2);
+
+    shp_write_be_int32(&writer->shp, writer->n_records + 1);
+    shp_write_be_int32(&writer->shp, 2);
+    shp_write_le_int32(&writer->shp, SHP_TYPE_NULL);
+
+    writer->n_records++;
+}
+
+void shp_writer_initialize(int* dirty, void* handler_data) {
+    if (*dirty) {
+        Rf_error("Can't re-use this wk_handler");
+    }
+
+    *dirty = 1;
+}
+
+int shp_writer_vector_start(const wk_vector_meta_t* meta, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    if ((meta->size != WK_VECTOR_SIZE_UNKNOWN) && (meta->size > INT32_MAX)) {
+        Rf_error("Can't write more than %d features to a shapefile", INT32_MAX);
+    }
+
+    double empty_bounds[8] = {R_PosInf, R_PosInf, R_NegInf, R_NegInf, R_PosInf, R_NegInf, R_PosInf, R_NegInf};
+    memcpy(writer->bounds, empty_bounds, sizeof(empty_bounds));
+
+    if (!(meta->flags & WK_FLAG_DIMS_UNKNOWN)) {
+        writer->shape_type = shp_writer_shape_type(meta->geometry_type, meta->flags);
+    }
+
+    shp_write_buffer_open(&writer->shp);
+    shp_write_buffer_open(&writer->shx);
+
+    unsigned char header[SHP_HEADER_SIZE];
+    memset(header, 0, SHP_HEADER_SIZE);
+    shp_write_bytes(&writer->shp, header, SHP_HEADER_SIZE);
+    shp_write_bytes(&writer->shx, header, SHP_HEADER_SIZE);
+    return WK_CONTINUE;
+}
+
+int shp_writer_feature_start(const wk_vector_meta_t* meta, R_xlen_t feat_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    if (writer->n_records == INT32_MAX) {
+        Rf_error("Can't write more than %d features to a shapefile", INT32_MAX);
+    }
+
+    writer->feature_null = 0;
+    writer->feature_type = WK_GEOMETRY;
+    writer->feature_flags = 0;
+    writer->level = 0;
+    writer->n_points = 0;
+    writer->n_parts = 0;
+    return WK_CONTINUE;
+}
+
+int shp_writer_null_feature(void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    writer->feature_null = 1;
+    return WK_CONTINUE;
+}
+
+int shp_writer_geometry_start(const wk_meta_t* meta, uint32_t part_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    writer->level++;
+    if (writer->level == 1) {
+        writer->feature_type = meta->geometry_type;
+    }
+
+    switch (meta->geometry_type) {
+    case WK_POINT:
+    case WK_MULTIPOINT:
+    case WK_POLYGON:
+    case WK_MULTILINESTRING:
+    case WK_MULTIPOLYGON:
+        break;
+    case WK_LINESTRING:
+        shp_writer_push_part(writer);
+        break;
+    case WK_GEOMETRYCOLLECTION:
+        Rf_error("Can't write a geometry collection to a shapefile");
+    default:
+        Rf_error("Can't write geometry type %u to a shapefile", meta->geometry_type);
+    }
+
+    return WK_CONTINUE;
+}
+
+int shp_writer_ring_start(const wk_meta_t* meta, uint32_t size, uint32_t ring_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    shp_writer_push_part(writer);
+    if (size != WK_SIZE_UNKNOWN) {
+        // one extra in case the ring needs to be closed
+        shp_writer_reserve_points(writer, size + 1);
+    }
+    return WK_CONTINUE;
+}
+
+int shp_writer_coord(const wk_meta_t* meta, const double* coord, uint32_t coord_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    shp_writer_reserve_points(writer, 1);
+
+    uint32_t i = writer->n_points++;
+    writer->xy[i * 2] = coord[0];
+    writer->xy[i * 2 + 1] = coord[1];
+
+    int coord_i = 2;
+    if (meta->flags & WK_FLAG_HAS_Z) {
+        writer->z[i] = coord[coord_i++];
+    } else {
+        writer->z[i] = 0;
+    }
+
+    if (meta->flags & WK_FLAG_HAS_M) {
+        writer->m[i] = coord[coord_i];
+    } else {
+        writer->m[i] = NA_REAL;
+    }
+
+    writer->feature_flags |= meta->flags & (WK_FLAG_HAS_Z | WK_FLAG_HAS_M);
+    return WK_CONTINUE;
+}
+
+// Registered for shp_writer_coord() (see shp_init_c_callables()) so that
+// shp_geometry() vectors pass each linestring or ring in one call
+int shp_writer_coord_span(const wk_meta_t* meta, const double* coords, uint32_t n_coords,
+                          uint32_t stride, uint32_t coord_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    shp_writer_reserve_points(writer, n_coords);
+
+    int has_z = (meta->flags & WK_FLAG_HAS_Z) != 0;
+    int has_m = (meta->flags & WK_FLAG_HAS_M) != 0;
+    uint32_t i = writer->n_points;
+    for (uint32_t j = 0; j < n_coords; j++, i++) {
+        const double* coord = coords + j * stride;
+        writer->xy[i * 2] = coord[0];
+        writer->xy[i * 2 + 1] = coord[1];
+        writer->z[i] = has_z ? coord[2] : 0;
+        writer->m[i] = has_m ? coord[2 + has_z] : NA_REAL;
+    }
+
+    writer->n_points = i;
+    writer->feature_flags |= meta->flags & (WK_FLAG_HAS_Z | WK_FLAG_HAS_M);
+    return WK_CONTINUE;
+}
+
+// The same as shp_writer_coord() but without a span callback registered
+// (used to test that both give identical output)
+int shp_writer_coord_single(const wk_meta_t* meta, const double* coord, uint32_t coord_id, void* handler_data) {
+    return shp_writer_coord(meta, coord, coord_id, handler_data);
+}
+
+int shp_writer_ring_end(const wk_meta_t* meta, uint32_t size, uint32_t ring_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    shp_writer_finish_ring(writer, ring_id);
+    return WK_CONTINUE;
+}
+
+int shp_writer_geometry_end(const wk_meta_t* meta, uint32_t part_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    writer->level--;
+
+    // drop empty linestrings
+    if ((meta->geometry_type == WK_LINESTRING) && (writer->parts[writer->n_parts - 1] == writer->n_points)) {
+        writer->n_parts--;
+    }
+
+    return WK_CONTINUE;
+}
+
+int shp_writer_feature_end(const wk_vector_meta_t* meta, R_xlen_t feat_id, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+
+    // Empty geometries are written as null shapes
+    if (writer->feature_null || (writer->n_points == 0)) {
+        shp_writer_write_null(writer);
+        return WK_CONTINUE;
+    }
+
+    uint32_t shape_type = shp_writer_shape_type(writer->feature_type, writer->feature_flags);
+    if (writer->shape_type == SHP_TYPE_NULL) {
+        writer->shape_type = shape_type;
+    } else if ((shape_type % 10) != (writer->shape_type % 10)) {
+        Rf_error(
+            "[i=%ld] Can't write a %s feature to a shapefile of %s features",
+            (long) feat_id + 1,
+            shp_writer_type_label(shape_type),
+            shp_writer_type_label(writer->shape_type)
+        );
+    } else if (shp_shape_type_has_z(shape_type) && !shp_shape_type_has_z(writer->shape_type)) {
+        Rf_error("[i=%ld] Can't write a feature with Z values to a shapefile without Z values", (long) feat_id + 1);
+    } else if (shp_shape_type_has_m(shape_type) && (writer->shape_type < SHP_TYPE_POINTZ)) {
+        Rf_error("[i=%ld] Can't write a feature with M values to a shapefile without M values", (long) feat_id + 1);
+    }
+
+    shp_writer_write_record(writer, writer->shape_type);
+    return WK_CONTINUE;
+}
+
+SEXP shp_writer_vector_end(const wk_vector_meta_t* meta, void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+
+    // bounds that don't exist (e.g., for a file with no non-null
+    // features) are written as 0
+    double bounds[8];
+    for (int i = 0; i < 8; i++) {
+        bounds[i] = R_FINITE(writer->bounds[i]) ? writer->bounds[i] : 0;
+    }
+
+    shp_write_buffer_finish(&writer->shp, writer->shape_type, bounds);
+    shp_write_buffer_finish(&writer->shx, writer->shape_type, bounds);
+    return Rf_ScalarInteger(writer->n_records);
+}
+
+void shp_writer_deinitialize(void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    shp_write_buffer_close(&writer->shp);
+    shp_write_buffer_close(&writer->shx);
+}
+
+void shp_writer_finalize(void* handler_data) {
+    shp_writer_t* writer = (shp_writer_t*) handler_data;
+    if (writer == NULL) {
+        return;
+    }
+
+    shp_write_buffer_free(&writer->shp);
+    shp_write_buffer_free(&writer->shx);
+    free(writer->xy);
+    free(writer->z);
+    free(writer->m);
+    free(writer->parts);
+    free(writer);
+}
+
+char* shp_writer_filename(SEXP filename) {
+    const char* path = R_ExpandFileName(Rf_translateChar(STRING_ELT(filename, 0)));
+    char* out = (char*) malloc(strlen(path) + 1);
+    if (out == NULL) {
+        Rf_error("Failed to allocate filename");
+    }
+
+    strcpy(out, path);
+    return out;
+}
+
+SEXP shp_c_shp_writer_new(SEXP filename_shp, SEXP filename_shx, SEXP coord_span_sexp) {
+    int coord_span = LOGICAL(coord_span_sexp)[0];
+
+    wk_handler_t* handler = wk_handler_create();
+    handler->initialize = &shp_writer_initialize;
+    handler->vector_start = &shp_writer_vector_start;
+    handler->feature_start = &shp_writer_feature_start;
+    handler->null_feature = &shp_writer_null_feature;
+    handler->geometry_start = &shp_writer_geometry_start;
+    handler->ring_start = &shp_writer_ring_start;
+    handler->coord = coord_span ? &shp_writer_coord : &shp_writer_coord_single;
+    handler->ring_end = &shp_writer_ring_end;
+    handler->geometry_end = &shp_writer_geometry_end;
+    handler->feature_end = &shp_writer_feature_end;
+    handler->vector_end = &shp_writer_vector_end;
+    handler->deinitialize = &shp_writer_deinitialize;
+    handler->finalizer = &shp_writer_finalize;
+
+    // the handler (and anything attached to it) is freed by the finalizer
+    SEXP xptr = PROTECT(wk_handler_create_xptr(handler, R_NilValue, R_NilValue));
+
+    shp_writer_t* writer = (shp_writer_t*) calloc(1, sizeof(shp_writer_t));
+    if (writer == NULL) {
+        Rf_error("Failed to allocate shapefile writer");
+    }
+
+    shp_write_buffer_init(&writer->shp);
+    shp_write_buffer_init(&writer->shx);
+    handler->handler_data = writer;
+
+    writer->shp.filename = shp_writer_filename(filename_shp);
+    writer->shx.filename = shp_writer_filename(filename_shx);
+
+    UNPROTECT(1);
+    return xptr;
+}